@@ -0,0 +1,39 @@
+// main() for the benchmarks that are built once for each tree (see
+// bench_tree.h): runs the float one, then the SIMD one if this CPU can run
+// AVX2. CMakeLists.txt builds this with BENCH set to the name the benchmark
+// gives its entry point, e.g. BENCH=traversal for traversal_float() and
+// traversal_simd(), which get the arguments as they came.
+//
+// Only this file checks the CPU: the SIMD half is built with -mavx2, and
+// the compiler would be free to use it in the very code doing the check.
+
+#include <cstdio>
+
+#include "../settings.h"
+#include "../renderer.h"
+#include "../dispatch.h"
+
+#ifndef BENCH
+# error "Build this with BENCH set to the benchmark's name (see CMakeLists.txt)"
+#endif
+
+#define BENCH_JOIN(name, tree) name##_##tree
+#define BENCH_ENTRY(name, tree) BENCH_JOIN(name, tree)
+
+int BENCH_ENTRY(BENCH, float)(int argc, char **argv);
+int BENCH_ENTRY(BENCH, simd)(int argc, char **argv);
+
+int main(int argc, char **argv)
+{
+    printf("== standard float vectors ==\n");
+    int result = BENCH_ENTRY(BENCH, float)(argc, argv);
+    if (result != 0) return result;
+
+    if (!backend_supported(Backend::AVX2))
+    {
+        printf("\nThis CPU can't run the AVX2 build; only the float tree was timed.\n");
+        return 0;
+    }
+    printf("\n== SIMD vectors, AVX2 ==\n");
+    return BENCH_ENTRY(BENCH, simd)(argc, argv);
+}
@@ -0,0 +1,88 @@
+#ifndef BENCHTREEH
+#define BENCHTREEH
+
+// The top of every benchmark that's built once for each tree: CMakeLists.txt
+// builds the file twice, with BENCH_SIMD=0 and no -m flags for the float
+// tree, and with BENCH_SIMD=1 and -mavx2 -mfma for the SIMD one, the same as
+// the avx2 backend. Each copy has the tree in a namespace of its own, like
+// render_float.cpp and render_simd.cpp do, and BENCH_TREE_FN(name) gives its
+// entry point a name of its own: name_float or name_simd. bench_main.cpp (or
+// the benchmark's own main(), for kernel-bench) calls the two.
+//
+// The system headers the tree's headers include come first, so that they stay
+// out of the namespace; their include guards keep them from being pulled in
+// again inside it. random.h, sampler.h, work_deque.h and the other
+// top-level headers both trees share (ray.h, hitable.h, lights.h,
+// thread_pool.h...) come in with the tree, inside it.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <bits/stdc++.h>
+
+#include "../macros.h"
+#include "../settings.h"
+
+#ifndef BENCH_SIMD
+# error "Build this with BENCH_SIMD set to 0 or 1 (see CMakeLists.txt)"
+#endif
+
+#if BENCH_SIMD
+namespace bench_simd
+{
+    #include "../simd/vector.h"
+    #include "../simd/vector_soa.h"
+    #include "../ray.h"
+    #include "../simd/camera.h"
+    #include "../hitable.h"
+    #include "../simd/hitable_list.h"
+    #include "../simd/sphere.h"
+    #include "../simd/material.h"
+    #include "../lights.h"
+    #include "../simd/wavefront.h"
+    #include "../thread_pool.h"
+    #include "../simd/bvh.h"
+    #include "../simd/wide_bvh.h"
+}
+using namespace bench_simd;
+#define BENCH_TREE_FN(name) name##_simd
+#else
+namespace bench_float
+{
+    #include "../float/vector.h"
+    #include "../ray.h"
+    #include "../float/camera.h"
+    #include "../hitable.h"
+    #include "../float/hitable_list.h"
+    #include "../float/sphere.h"
+    #include "../float/material.h"
+    #include "../lights.h"
+    #include "../float/wavefront.h"
+    #include "../thread_pool.h"
+    #include "../float/bvh.h"
+    #include "../float/wide_bvh.h"
+}
+using namespace bench_float;
+#define BENCH_TREE_FN(name) name##_float
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+// Compares the megakernel integrator against the wavefront one on the
+// main.cpp scene, traced through an 8-wide BVH. The megakernel is also run
+// once more with russian roulette turned the other way, to show how much
+// shorter it makes the paths.
+//
+// Extra spheres can be scattered over the ground like NUM_EXTRA_SPHERES; how
+// many is the first argument (0 by default). The whole frame is rendered a
+// few times with each integrator, and the best time is kept. The two should
+// draw exactly the same image, which is checked too.
+
+#include "bench_tree.h"
+
+#define NUM_RUNS 3
+
+double benchIntegrator(const char *name, Integrator integrator, bool roulette, threadInfo *pInfo)
+{
+    ThreadPool pool(std::thread::hardware_concurrency(), SCHEDULING);
+    pool.setIntegrator(integrator);
+    pool.setRussianRoulette(roulette);
+    pool.init(pInfo);
+
+    double best = 1e30;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        pool.clear();
+        auto start = std::chrono::steady_clock::now();
+        pool.start();
+        pool.waitUntilDone();
+        pool.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    pool.resolve();
+    const double samples = double(WINDOW_WIDTH) * WINDOW_HEIGHT * NUM_ALIAS_STEPS;
+    printf("%-26s %7.3fs   %7.3f Msamples/s   %.3f rays/sample\n", name, best, samples / best / 1e6,
+        double(pool.raysTraced()) / pool.samplesTraced());
+    return best;
+}
+
+int BENCH_TREE_FN(integrator)(int argc, char **argv)
+{
+    const int numExtra = (argc > 1)? atoi(argv[1]) : 0;
+
+    MaterialTable materials;
+    std::vector<Sphere*> dList;
+    dList.push_back(new Sphere(vec3( 0,   100.6, -2  ), 100, materials.add(Diffuse(   vec3(0.3, 0.5, 0.7)                ))));
+    dList.push_back(new Sphere(vec3( 0,     0,   -2  ), 0.5, materials.add(Diffuse(   vec3(0.8, 0.3, 0.3)                ))));
+    dList.push_back(new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, materials.add(Metal(     vec3(0.7, 0.7, 0.7),   0.4         ))));
+    dList.push_back(new Sphere(vec3( 1,     0,   -2  ), 0.4, materials.add(Metal(     vec3(0.3, 0.4, 0.9),   0.05        ))));
+    dList.push_back(new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, materials.add(Glass(     vec3(0.5, 1.0, 0.6),   0.9         ))));
+    dList.push_back(new Sphere(vec3( 0,     0.2,  1  ), 0.3, materials.add(Glass(     vec3(0.8, 0.2, 0.3),   0.0         ))));
+    dList.push_back(new Sphere(vec3(-1,    -0.3, -1.2), 0.2, materials.add(Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, materials.add(Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0,    -5.0, -3  ), 2.0, materials.add(Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false ))));
+
+    Rng sceneRng(1);
+    for (int i = 0; i < numExtra; i++)
+    {
+        const float x = 24.0f * sceneRng.next_float() - 12.0f;
+        const float z = -14.0f * sceneRng.next_float() + 1.5f;
+        const float r = 0.02f + 0.06f * sceneRng.next_float();
+        const float ground = 100.6f - sqrt(100.0f*100.0f - x*x - (z+2)*(z+2));
+        const vec3 albedo(sceneRng.next_float(), sceneRng.next_float(), sceneRng.next_float());
+        uint32_t mat;
+        if (sceneRng.next_float() < 0.8f) mat = materials.add(Diffuse(albedo));
+        else mat = materials.add(Metal(albedo, 0.3f * sceneRng.next_float()));
+        dList.push_back(new Sphere(vec3(x, ground - r, z), r, mat));
+    }
+    WideBVH<8> bvh(dList.data(), dList.size());
+    LightList lights(dList.data(), dList.size(), materials);
+
+    Camera cam(
+            vec3(-1,0,2),
+            vec3(0,0,-1),
+            vec3(0,1,0),
+            70,
+            (float)WINDOW_WIDTH/WINDOW_HEIGHT
+        );
+
+    const int numPixels = WINDOW_WIDTH * WINDOW_HEIGHT;
+    PixelStats *pAccumBuffer = new PixelStats[numPixels];
+    uint32_t *pMegakernel = new uint32_t[numPixels];
+    uint32_t *pWavefront = new uint32_t[numPixels];
+    threadInfo megakernelInfo { &bvh, &materials, &lights, &cam, pAccumBuffer, pMegakernel };
+    threadInfo wavefrontInfo { &bvh, &materials, &lights, &cam, pAccumBuffer, pWavefront };
+
+    printf("%dx%d, %d samples, %d spheres, %d runs each\n",
+        WINDOW_WIDTH, WINDOW_HEIGHT, NUM_ALIAS_STEPS, (int)dList.size(), NUM_RUNS);
+    const double megakernel = benchIntegrator("megakernel", Integrator::Megakernel, RUSSIAN_ROULETTE, &megakernelInfo);
+    const double wavefront = benchIntegrator("wavefront", Integrator::Wavefront, RUSSIAN_ROULETTE, &wavefrontInfo);
+    printf("wavefront is %.2fx the megakernel's speed\n", megakernel / wavefront);
+    // the image this draws is different, so it goes in its own buffer
+    uint32_t *pOther = new uint32_t[numPixels];
+    threadInfo otherInfo { &bvh, &materials, &lights, &cam, pAccumBuffer, pOther };
+    benchIntegrator(RUSSIAN_ROULETTE? "megakernel, no roulette" : "megakernel, roulette",
+                    Integrator::Megakernel, !RUSSIAN_ROULETTE, &otherInfo);
+    delete[] pOther;
+
+    int mismatches = 0;
+    for (int i = 0; i < numPixels; i++)
+        if (pMegakernel[i] != pWavefront[i]) mismatches++;
+    if (mismatches) printf("%d PIXELS DIFFER\n", mismatches);
+    else printf("images match\n");
+
+    delete[] pAccumBuffer;
+    delete[] pMegakernel;
+    delete[] pWavefront;
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Times the small things everything else is made of, one call at a time,
+// in both trees: the vec3 operations, Sphere::hit() on rays that hit and
+// rays that miss, HitableList::hit() over lists of a few sizes, and
+// scatter() for each kind of material. It's what the old commented-out
+// _main() in main.cpp set out to do, comparing the float and SIMD vec3s
+// head to head.
+//
+// Each kernel's inputs cycle through a small array of random ones, and its
+// result goes to keep() (see kernel_bench.h), so the compiler can neither
+// work it out ahead of time nor leave it out. Each is warmed up, then timed
+// in batches, and the fastest batch is the one that's printed, in
+// nanoseconds per call. The loop's own cost is the first row; it's included
+// in all the others.
+//
+// The float tree is built with no -m flags, the SIMD one with AVX2 and FMA,
+// the same as the avx2 backend (see bench_tree.h); the SIMD column is left
+// out on a CPU that can't run it. The one argument, if there is one, only
+// runs the kernels whose names have it in them:
+//   kernel-bench                 everything
+//   kernel-bench scatter         only the materials
+
+#include <cstdio>
+#include <vector>
+
+#include "../settings.h"
+#include "../renderer.h"
+#include "../dispatch.h"
+#include "kernel_bench.h"
+
+void run_kernels_float(std::vector<KernelTiming> &out, const char *filter);
+void run_kernels_simd(std::vector<KernelTiming> &out, const char *filter);
+
+int main(int argc, char **argv)
+{
+    const char *filter = (argc > 1)? argv[1] : nullptr;
+    const bool simd = backend_supported(Backend::AVX2);
+
+    std::vector<KernelTiming> floatTimes, simdTimes;
+    fprintf(stderr, "float tree...\n");
+    run_kernels_float(floatTimes, filter);
+    if (simd)
+    {
+        fprintf(stderr, "SIMD tree (AVX2)...\n");
+        run_kernels_simd(simdTimes, filter);
+    }
+    else fprintf(stderr, "This CPU can't run the AVX2 build; only timing the float tree.\n");
+
+    printf("%-28s %12s %12s %9s\n", "kernel", "float ns/op", "simd ns/op", "speedup");
+    for (size_t i = 0; i < floatTimes.size(); i++)
+    {
+        printf("%-28s %12.2f", floatTimes[i].name.c_str(), floatTimes[i].ns);
+        if (simd) printf(" %12.2f %8.2fx", simdTimes[i].ns, floatTimes[i].ns / simdTimes[i].ns);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef KERNELBENCHH
+#define KERNELBENCHH
+
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The timing half of kernel-bench, shared by both trees (see
+// kernel_bench.cpp).
+
+// every kernel's inputs are picked from this many of each, cycling, so they
+// stay in L1 and the compiler can't know them ahead of time
+#define KERNEL_INPUTS 1024
+// how long each timed batch should take, and how many of them to take the
+// fastest of
+#define KERNEL_BATCH_SECONDS 0.005
+#define KERNEL_REPEATS 7
+#define KERNEL_WARMUP_SECONDS 0.02
+
+struct KernelTiming
+{
+    std::string name;
+    double ns;          // per call
+};
+
+// makes the compiler keep value, and work it out every time: as far as it
+// knows, the asm reads it. (this is what Google Benchmark's DoNotOptimize()
+// does.)
+template<typename T>
+inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// nanoseconds per call of fn(i), with i counting up. fn is run for a while
+// first, untimed, to warm up the caches and branch predictors and let the
+// clock speed settle. then it's timed in batches of a size that takes about
+// KERNEL_BATCH_SECONDS, and the fastest batch wins: anything that gets in
+// the way (interrupts, other processes) can only make a batch slower.
+template<typename F>
+double time_kernel(F fn)
+{
+    typedef std::chrono::steady_clock clock;
+    uint32_t i = 0;
+    const auto warmupEnd = clock::now() + std::chrono::duration<double>(KERNEL_WARMUP_SECONDS);
+    while (clock::now() < warmupEnd)
+        for (int k = 0; k < KERNEL_INPUTS; k++) fn(i++);
+
+    auto timeBatch = [&](uint64_t count) {
+        const auto start = clock::now();
+        for (uint64_t k = 0; k < count; k++) fn(i++);
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+    uint64_t batch = KERNEL_INPUTS;
+    while (timeBatch(batch) < KERNEL_BATCH_SECONDS) batch *= 2;
+
+    double best = 1e30;
+    for (int run = 0; run < KERNEL_REPEATS; run++)
+    {
+        const double seconds = timeBatch(batch);
+        if (seconds < best) best = seconds;
+    }
+    return best / batch * 1e9;
+}
+
+// times fn as name and adds it to out, unless filter is set and isn't part
+// of name
+template<typename F>
+void bench_kernel(std::vector<KernelTiming> &out, const char *filter, const char *name, F fn)
+{
+    if (filter && !strstr(name, filter)) return;
+    out.push_back(KernelTiming{ name, time_kernel(fn) });
+}
+
+#endif
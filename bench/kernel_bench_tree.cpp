@@ -0,0 +1,127 @@
+// kernel-bench's kernels, for one tree (see bench_tree.h). Both trees time
+// the same code on the same inputs, so their rows line up.
+
+#include "bench_tree.h"
+#include "kernel_bench.h"
+
+#define KERNEL_MASK (KERNEL_INPUTS - 1)
+static_assert((KERNEL_INPUTS & KERNEL_MASK) == 0, "KERNEL_INPUTS has to be a power of two");
+
+// a point somewhere in the cube from -1 to 1
+static vec3 random_point(Rng &rng)
+{
+    return vec3(2*rng.next_float() - 1, 2*rng.next_float() - 1, 2*rng.next_float() - 1);
+}
+
+// rays from outside the unit sphere at the origin. with aim set they're all
+// pointed at somewhere inside half its radius, so they all hit it; without,
+// they're pointed at somewhere at least twice its radius off to one side,
+// so none do.
+static std::vector<ray> sphere_rays(Rng &rng, bool aim)
+{
+    std::vector<ray> rays;
+    while (rays.size() < KERNEL_INPUTS)
+    {
+        const vec3 origin = 4 * normalize(random_point(rng));
+        vec3 target = 0.5f * random_point(rng);
+        if (!aim) target += 3 * normalize(cross(origin, random_point(rng)));
+        rays.push_back(ray(origin, normalize(target - origin)));
+    }
+    return rays;
+}
+
+void BENCH_TREE_FN(run_kernels)(std::vector<KernelTiming> &out, const char *filter)
+{
+    Rng rng(7);
+    Sampler sampler(SamplerKind::Random, 0, 0, 0);
+    std::vector<vec3> a(KERNEL_INPUTS), b(KERNEL_INPUTS), n(KERNEL_INPUTS);
+    for (int i = 0; i < KERNEL_INPUTS; i++)
+    {
+        a[i] = random_point(rng);
+        b[i] = random_point(rng);
+        n[i] = normalize(random_point(rng));
+    }
+
+    // what the loop itself costs, picking the inputs and all; it's in every
+    // other row too
+    bench_kernel(out, filter, "loop overhead", [&](uint32_t i) { keep(a[i & KERNEL_MASK]); });
+
+    // vec3
+    bench_kernel(out, filter, "vec3 add", [&](uint32_t i) { keep(a[i & KERNEL_MASK] + b[i & KERNEL_MASK]); });
+    bench_kernel(out, filter, "vec3 mul", [&](uint32_t i) { keep(a[i & KERNEL_MASK] * b[i & KERNEL_MASK]); });
+    bench_kernel(out, filter, "vec3 scale", [&](uint32_t i) { keep(0.7f * a[i & KERNEL_MASK]); });
+    bench_kernel(out, filter, "vec3 div", [&](uint32_t i) { keep(a[i & KERNEL_MASK] / 0.7f); });
+    bench_kernel(out, filter, "vec3 dot", [&](uint32_t i) { keep(dot(a[i & KERNEL_MASK], b[i & KERNEL_MASK])); });
+    bench_kernel(out, filter, "vec3 cross", [&](uint32_t i) { keep(cross(a[i & KERNEL_MASK], b[i & KERNEL_MASK])); });
+    bench_kernel(out, filter, "vec3 length", [&](uint32_t i) { keep(a[i & KERNEL_MASK].length()); });
+    bench_kernel(out, filter, "vec3 normalize", [&](uint32_t i) { keep(normalize(a[i & KERNEL_MASK])); });
+    bench_kernel(out, filter, "vec3 reflect", [&](uint32_t i) { keep(reflect(a[i & KERNEL_MASK], n[i & KERNEL_MASK])); });
+    bench_kernel(out, filter, "vec3 clamp", [&](uint32_t i) {
+        vec3 v = a[i & KERNEL_MASK];
+        keep(v.clamp(-0.5f, 0.5f));
+    });
+    bench_kernel(out, filter, "random_in_unit_sphere", [&](uint32_t) { keep(random_in_unit_sphere(sampler)); });
+    bench_kernel(out, filter, "random_unit_vector", [&](uint32_t) { keep(random_unit_vector(sampler)); });
+    bench_kernel(out, filter, "random_cosine_direction", [&](uint32_t i) {
+        keep(random_cosine_direction(n[i & KERNEL_MASK], sampler));
+    });
+
+    // Sphere::hit(), through Hitable like everything else calls it
+    Sphere unit(vec3(0, 0, 0), 1, 0);
+    const Hitable *pUnit = &unit;
+    const std::vector<ray> hits = sphere_rays(rng, true), misses = sphere_rays(rng, false);
+    bench_kernel(out, filter, "Sphere::hit, hit", [&](uint32_t i) {
+        hit_record rec;
+        keep(pUnit->hit(hits[i & KERNEL_MASK], 0.001f, FLT_MAX, rec));
+        keep(rec);
+    });
+    bench_kernel(out, filter, "Sphere::hit, miss", [&](uint32_t i) {
+        hit_record rec;
+        keep(pUnit->hit(misses[i & KERNEL_MASK], 0.001f, FLT_MAX, rec));
+    });
+
+    // HitableList::hit(), over spheres scattered through the cube from -1 to
+    // 1, from rays starting out in the same cube
+    std::vector<ray> rays(KERNEL_INPUTS);
+    for (int i = 0; i < KERNEL_INPUTS; i++) rays[i] = ray(a[i], n[i]);
+    for (int size : { 1, 4, 16, 64, 256 })
+    {
+        std::vector<Sphere> spheres;
+        for (int i = 0; i < size; i++) spheres.push_back(Sphere(random_point(rng), 0.05f, 0));
+        std::vector<Hitable*> pointers;
+        for (Sphere &s : spheres) pointers.push_back(&s);
+        HitableList list(pointers.data(), size);
+        const Hitable *pList = &list;
+
+        char name[64];
+        snprintf(name, sizeof(name), "HitableList::hit, %d", size);
+        bench_kernel(out, filter, name, [&](uint32_t i) {
+            hit_record rec;
+            keep(pList->hit(rays[i & KERNEL_MASK], 0.001f, FLT_MAX, rec));
+            keep(rec);
+        });
+    }
+
+    // scatter() for each kind of material, on where the hits above landed
+    std::vector<hit_record> recs(KERNEL_INPUTS);
+    for (int i = 0; i < KERNEL_INPUTS; i++) pUnit->hit(hits[i], 0.001f, FLT_MAX, recs[i]);
+    const struct { const char *name; Material m; } materials[] = {
+        { "scatter, diffuse",     Diffuse(vec3(0.8, 0.3, 0.3)) },
+        { "scatter, metal",       Metal(vec3(0.7, 0.7, 0.7), 0.4) },
+        { "scatter, emmissive",   Emmissive(vec3(1.0, 1.0, 1.0), 4.0, false) },
+        { "scatter, glass",       Glass(vec3(0.8, 0.9, 1.0), 1.5) },
+        { "scatter, translucent", Translucent(vec3(0.6, 0.8, 0.6), 0.5, 0.2) },
+        { "scatter, normals",     Normals() },
+    };
+    for (const auto &material : materials)
+    {
+        bench_kernel(out, filter, material.name, [&](uint32_t i) {
+            ray r = hits[i & KERNEL_MASK];
+            vec3 attenuation;
+            bool isLight;
+            keep(scatter(material.m, r, recs[i & KERNEL_MASK], attenuation, isLight, sampler));
+            keep(r);
+            keep(attenuation);
+        });
+    }
+}
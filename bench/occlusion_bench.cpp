@@ -0,0 +1,133 @@
+// Compares occluded() against hit() on shadow rays, through the binary BVH
+// and the 4- and 8-wide ones.
+//
+// The scene is main.cpp's spheres plus a field of small ones over the
+// ground, like NUM_EXTRA_SPHERES; how many is the first argument (100000 by
+// default). For every pixel, the camera ray's hit aims a shadow ray at a
+// light, picked the way next event estimation picks them. Each structure
+// then answers "is it blocked?" for all of them, once with a full
+// closest-hit search and once with the any-hit one, and the two have to
+// agree.
+
+#include "bench_tree.h"
+
+#define NUM_RUNS 3
+
+// whether each ray is blocked before its tMax
+void traceAll(const Hitable *pAccel, const std::vector<ray> &rays, const std::vector<float> &tMax,
+              bool anyHit, std::vector<uint8_t> &blocked)
+{
+    blocked.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        if (anyHit) blocked[i] = pAccel->occluded(rays[i], 0.0001f, tMax[i]);
+        else
+        {
+            hit_record rec;
+            blocked[i] = pAccel->hit(rays[i], 0.0001f, tMax[i], rec);
+        }
+    }
+}
+
+double benchQuery(const Hitable *pAccel, const std::vector<ray> &rays, const std::vector<float> &tMax,
+                  bool anyHit, std::vector<uint8_t> &blocked)
+{
+    double best = 1e30;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        traceAll(pAccel, rays, tMax, anyHit, blocked);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    return best;
+}
+
+void benchAccel(const char *name, const Hitable *pAccel, const std::vector<ray> &rays, const std::vector<float> &tMax)
+{
+    std::vector<uint8_t> closest, any;
+    const double hitSeconds = benchQuery(pAccel, rays, tMax, false, closest);
+    const double occludedSeconds = benchQuery(pAccel, rays, tMax, true, any);
+
+    int mismatches = 0;
+    for (size_t i = 0; i < rays.size(); i++)
+        if (closest[i] != any[i]) mismatches++;
+    printf("  %-6s hit() %8.3f Mrays/s   occluded() %8.3f Mrays/s   %.2fx",
+        name, rays.size() / hitSeconds / 1e6, rays.size() / occludedSeconds / 1e6, hitSeconds / occludedSeconds);
+    if (mismatches) printf("   %d MISMATCHES", mismatches);
+    printf("\n");
+}
+
+int BENCH_TREE_FN(occlusion)(int argc, char **argv)
+{
+    const int numExtra = (argc > 1)? atoi(argv[1]) : 100000;
+
+    MaterialTable materials;
+    std::vector<Sphere*> dList;
+    dList.push_back(new Sphere(vec3( 0,   100.6, -2  ), 100, materials.add(Diffuse(   vec3(0.3, 0.5, 0.7)                ))));
+    dList.push_back(new Sphere(vec3( 0,     0,   -2  ), 0.5, materials.add(Diffuse(   vec3(0.8, 0.3, 0.3)                ))));
+    dList.push_back(new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, materials.add(Metal(     vec3(0.7, 0.7, 0.7),   0.4         ))));
+    dList.push_back(new Sphere(vec3( 1,     0,   -2  ), 0.4, materials.add(Metal(     vec3(0.3, 0.4, 0.9),   0.05        ))));
+    dList.push_back(new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, materials.add(Glass(     vec3(0.5, 1.0, 0.6),   0.9         ))));
+    dList.push_back(new Sphere(vec3( 0,     0.2,  1  ), 0.3, materials.add(Glass(     vec3(0.8, 0.2, 0.3),   0.0         ))));
+    dList.push_back(new Sphere(vec3(-1,    -0.3, -1.2), 0.2, materials.add(Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, materials.add(Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0,    -5.0, -3  ), 2.0, materials.add(Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false ))));
+
+    Rng sceneRng(1);
+    const uint32_t ground = materials.add(Diffuse(vec3(0.5, 0.5, 0.5)));
+    for (int i = 0; i < numExtra; i++)
+    {
+        const float x = 24.0f * sceneRng.next_float() - 12.0f;
+        const float z = -14.0f * sceneRng.next_float() + 1.5f;
+        const float r = 0.02f + 0.06f * sceneRng.next_float();
+        const float groundY = 100.6f - sqrt(100.0f*100.0f - x*x - (z+2)*(z+2));
+        dList.push_back(new Sphere(vec3(x, groundY - r, z), r, ground));
+    }
+
+    ThreadPool pool(std::thread::hardware_concurrency());
+    BVH bvh2(dList.data(), dList.size(), &pool);
+    WideBVH<4> bvh4(dList.data(), dList.size(), &pool);
+    WideBVH<8> bvh8(dList.data(), dList.size(), &pool);
+    LightList lights(dList.data(), dList.size(), materials);
+
+    Camera cam(
+            vec3(-1,0,2),
+            vec3(0,0,-1),
+            vec3(0,1,0),
+            70,
+            (float)WINDOW_WIDTH/WINDOW_HEIGHT
+        );
+
+    std::vector<ray> shadow;
+    std::vector<float> tMax;
+    // one long run of plain random numbers, with no dimensions to keep in step
+    Sampler sampler(SamplerKind::Random, 0, 0, 2);
+    for (int y = 0; y < WINDOW_HEIGHT; y++)
+        for (int x = 0; x < WINDOW_WIDTH; x++)
+        {
+            ray r = cam.getRay(float(x) / WINDOW_WIDTH, float(y) / WINDOW_HEIGHT);
+            hit_record rec;
+            if (!bvh2.hit(r, 0.001f, FLT_MAX, rec)) continue;
+            ray shadowRay;
+            float t;
+            vec3 light;
+            if (lights.sample(rec, vec3(1,1,1), sampler, shadowRay, t, light))
+            {
+                shadow.push_back(shadowRay);
+                tMax.push_back(t);
+            }
+        }
+
+    std::vector<uint8_t> blocked;
+    traceAll(&bvh2, shadow, tMax, false, blocked);
+    int numBlocked = 0;
+    for (uint8_t b : blocked) numBlocked += b;
+    printf("%d spheres, %u lights: %d shadow rays, %.1f%% blocked\n", (int)dList.size(), lights.size(),
+        (int)shadow.size(), 100.0 * numBlocked / shadow.size());
+    benchAccel("bvh2", &bvh2, shadow, tMax);
+    benchAccel("bvh4", &bvh4, shadow, tMax);
+    benchAccel("bvh8", &bvh8, shadow, tMax);
+
+    return 0;
+}
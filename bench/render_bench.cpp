@@ -0,0 +1,242 @@
+// End to end: renders each of the canonical scenes (see SceneKind in
+// settings.h) a few times over, the way the program does, and prints what it
+// measured as JSON on stdout, for keeping and comparing against later runs.
+// Progress goes to stderr.
+//
+// Every run builds the scene and its BVH from scratch, traces every pixel's
+// samples in one pass, and resolves the image, each timed on the wall clock.
+// Adaptive sampling is off, so every run does exactly the same work: the
+// scenes are placed with fixed seeds, and each sample's random numbers come
+// from where it is. The image's hash is printed too; it should only change
+// when the picture does (and it differs between backends, since FMA rounds
+// differently).
+//
+// Takes the program's options (see parse_settings()), except that the
+// defaults are 640x360 at 8 samples per pixel, plus
+//   --runs N    timed runs per scene (5 by default), after one untimed one
+//   --scene S   only that scene, instead of all four
+
+#include <math.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../macros.h"
+#include "../settings.h"
+#include "../renderer.h"
+#include "../dispatch.h"
+
+// one number per run
+struct Series
+{
+    std::vector<double> values;
+
+    double mean() const
+    {
+        double sum = 0;
+        for (double v : values) sum += v;
+        return values.empty()? 0 : sum / values.size();
+    }
+    // the sample standard deviation
+    double stddev() const
+    {
+        if (values.size() < 2) return 0;
+        const double m = mean();
+        double sum = 0;
+        for (double v : values) sum += (v - m) * (v - m);
+        return sqrt(sum / (values.size() - 1));
+    }
+    double min() const
+    {
+        double m = values.empty()? 0 : values[0];
+        for (double v : values) m = (v < m)? v : m;
+        return m;
+    }
+    double max() const
+    {
+        double m = values.empty()? 0 : values[0];
+        for (double v : values) m = (v > m)? v : m;
+        return m;
+    }
+
+    void print(const char *name, const char *indent, bool last) const
+    {
+        printf("%s\"%s\": { \"mean\": %.6g, \"stddev\": %.6g, \"min\": %.6g, \"max\": %.6g, \"runs\": [",
+               indent, name, mean(), stddev(), min(), max());
+        for (size_t i = 0; i < values.size(); i++)
+            printf("%s%.6g", i? ", " : "", values[i]);
+        printf("] }%s\n", last? "" : ",");
+    }
+};
+
+struct SceneResult
+{
+    SceneKind scene;
+    uint32_t numThreads, numSpheres, numNodes, numLights;
+    uint64_t samples, rays;
+    uint64_t imageHash;
+    bool reproducible = true;    // every run drew the same image
+    Series setup, build, render, resolve, total, samplesPerSecond, raysPerSecond;
+};
+
+// FNV-1a, over the image's bytes
+uint64_t hashImage(const uint32_t *pPixels, size_t count)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    const uint8_t *p = (const uint8_t *)pPixels;
+    for (size_t i = 0; i < count * 4; i++) h = (h ^ p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// one run, start to finish; returns false if the backend can't run here
+bool renderOnce(const RenderSettings &settings, SceneResult &result, bool timed, std::vector<uint32_t> &frame)
+{
+    const auto start = std::chrono::steady_clock::now();
+    Renderer *pRenderer = make_renderer(settings);
+    if (!pRenderer) return false;
+    pRenderer->setup(frame.data());
+    pRenderer->setSamples(settings.samples);
+    pRenderer->setAdaptive(false);
+    pRenderer->clear();
+    const double setupSeconds = secondsSince(start);
+
+    const auto renderStart = std::chrono::steady_clock::now();
+    pRenderer->start();
+    uint32_t done = 0;
+    while (done < pRenderer->numTiles())
+        done = pRenderer->waitForProgress(done, 1000);
+    pRenderer->stop();
+    const double renderSeconds = secondsSince(renderStart);
+
+    const auto resolveStart = std::chrono::steady_clock::now();
+    pRenderer->resolve();
+    const double resolveSeconds = secondsSince(resolveStart);
+    const double totalSeconds = secondsSince(start);
+
+    const uint64_t hash = hashImage(frame.data(), frame.size());
+    if (!timed)
+    {
+        result.numThreads = pRenderer->getNumThreads();
+        result.numSpheres = pRenderer->numSpheres();
+        result.numNodes = pRenderer->numNodes();
+        result.numLights = pRenderer->numLights();
+        result.samples = pRenderer->samplesTraced();
+        result.rays = pRenderer->raysTraced();
+        result.imageHash = hash;
+    }
+    else
+    {
+        result.reproducible &= (hash == result.imageHash);
+        // the BVH build is part of setup; it's counted on its own
+        result.setup.values.push_back(setupSeconds - pRenderer->buildSeconds());
+        result.build.values.push_back(pRenderer->buildSeconds());
+        result.render.values.push_back(renderSeconds);
+        result.resolve.values.push_back(resolveSeconds);
+        result.total.values.push_back(totalSeconds);
+        result.samplesPerSecond.values.push_back(pRenderer->samplesTraced() / renderSeconds);
+        result.raysPerSecond.values.push_back(pRenderer->raysTraced() / renderSeconds);
+    }
+    delete pRenderer;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    RenderSettings settings;
+    settings.width = 640;
+    settings.height = 360;
+    settings.samples = 8;
+
+    // pull out the options that are only the benchmark's, and hand the rest
+    // to parse_settings()
+    int numRuns = 5;
+    bool oneScene = false;
+    std::vector<char *> args = { argv[0] };
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            if (!parse_int("--runs", argv[++i], 1, 1 << 30, numRuns)) return 1;
+        }
+        else
+        {
+            oneScene |= strcmp(argv[i], "--scene") == 0;
+            args.push_back(argv[i]);
+        }
+    }
+    if (!parse_settings(args.size(), args.data(), settings)) return 1;
+    if (settings.output || settings.headless)
+    {
+        fprintf(stderr, "The benchmark doesn't save images.\n");
+        return 1;
+    }
+
+    const Backend backend = (settings.backend == Backend::Auto)? best_backend() : settings.backend;
+    std::vector<SceneKind> scenes = { SceneKind::Default, SceneKind::Spheres, SceneKind::Glass, SceneKind::Lights };
+    if (oneScene) scenes = { settings.scene };
+
+    std::vector<uint32_t> frame(size_t(settings.width) * settings.height);
+    std::vector<SceneResult> results;
+    for (SceneKind scene : scenes)
+    {
+        RenderSettings s = settings;
+        s.scene = scene;
+        SceneResult result;
+        result.scene = scene;
+        fprintf(stderr, "%s: warming up", scene_name(scene));
+        if (!renderOnce(s, result, false, frame)) return 1;
+        for (int run = 0; run < numRuns; run++)
+        {
+            fprintf(stderr, ", run %d", run + 1);
+            renderOnce(s, result, true, frame);
+        }
+        fprintf(stderr, ": %.3fs +- %.3fs%s\n", result.render.mean(), result.render.stddev(),
+                result.reproducible? "" : ", IMAGES DIFFER BETWEEN RUNS");
+        results.push_back(result);
+    }
+
+    printf("{\n");
+    printf("  \"backend\": \"%s\",\n", backend_name(backend));
+    printf("  \"accel\": \"%s\",\n", accel_name(settings.accel));
+    printf("  \"integrator\": \"%s\",\n", integrator_name(settings.integrator));
+    printf("  \"threads\": %u,\n", results[0].numThreads);
+    printf("  \"width\": %d,\n", settings.width);
+    printf("  \"height\": %d,\n", settings.height);
+    printf("  \"samples_per_pixel\": %d,\n", settings.samples);
+    printf("  \"max_bounces\": %d,\n", settings.maxBounces);
+    printf("  \"runs\": %d,\n", numRuns);
+    printf("  \"scenes\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const SceneResult &r = results[i];
+        printf("    {\n");
+        printf("      \"name\": \"%s\",\n", scene_name(r.scene));
+        printf("      \"spheres\": %u,\n", r.numSpheres);
+        printf("      \"bvh_nodes\": %u,\n", r.numNodes);
+        printf("      \"lights\": %u,\n", r.numLights);
+        printf("      \"samples\": %llu,\n", (unsigned long long)r.samples);
+        printf("      \"rays\": %llu,\n", (unsigned long long)r.rays);
+        printf("      \"rays_per_sample\": %.4f,\n", double(r.rays) / r.samples);
+        printf("      \"image_hash\": \"%016llx\",\n", (unsigned long long)r.imageHash);
+        printf("      \"reproducible\": %s,\n", r.reproducible? "true" : "false");
+        printf("      \"seconds\": {\n");
+        r.setup.print("setup", "        ", false);
+        r.build.print("bvh_build", "        ", false);
+        r.render.print("render", "        ", false);
+        r.resolve.print("resolve", "        ", false);
+        r.total.print("total", "        ", true);
+        printf("      },\n");
+        r.samplesPerSecond.print("samples_per_second", "      ", false);
+        r.raysPerSecond.print("rays_per_second", "      ", true);
+        printf("    }%s\n", (i + 1 < results.size())? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+    return 0;
+}
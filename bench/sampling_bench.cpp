@@ -0,0 +1,219 @@
+// Compares the direct samplers in vector.h (and, in the SIMD tree, their
+// four- and eight-wide forms in vector_soa.h) against the rejection loop that
+// random_in_unit_sphere() used to be: three random numbers for a point in
+// the cube around the sphere, and try again if it's outside, which is
+// almost half the time.
+//
+// How many points to make is the first argument (4M by default). Every
+// sampler takes its random numbers from a PCG32 Rng as it goes, the way it
+// would when rendering, so the rejection loop's extra numbers are counted
+// against it. Each kind of point is checked against what it should average
+// out to, too:
+//   ball       -- squared distance from the middle: 3/5
+//   sphere     -- z: 0, and z squared: 1/3
+//   hemisphere -- cosine to the normal: 2/3
+// The rejection loop's hemisphere is the old scatter_diffuse(), the normal
+// plus a point *in* the sphere, which leans further towards the normal than
+// a Lambertian surface should.
+
+#include "bench_tree.h"
+
+#define NUM_RUNS 5
+
+enum class Shape { Ball, Sphere, Hemisphere };
+
+// the averages above, for one run's points
+void printStats(const char *name, Shape shape, const std::vector<vec3> &points, double seconds)
+{
+    const vec3 normal(0, 0, 1);
+    double a = 0, b = 0;
+    for (const vec3 &p : points)
+    {
+        switch (shape)
+        {
+            case Shape::Ball:       a += p.squared_length(); break;
+            case Shape::Sphere:     a += p[2]; b += p[2] * p[2]; break;
+            case Shape::Hemisphere: a += dot(normalize(p), normal); break;
+        }
+    }
+    a /= points.size();
+    b /= points.size();
+    printf("  %-22s %8.1f Mpoints/s   ", name, points.size() / seconds / 1e6);
+    switch (shape)
+    {
+        case Shape::Ball:       printf("E[|p|^2] %.4f (0.6000)\n", a); break;
+        case Shape::Sphere:     printf("E[z] %+.4f, E[z^2] %.4f (0.3333)\n", a, b); break;
+        case Shape::Hemisphere: printf("E[cos] %.4f (0.6667)\n", a); break;
+    }
+}
+
+// runs fill(points) a few times and keeps the best time
+template<typename F>
+void bench(const char *name, Shape shape, std::vector<vec3> &points, F fill)
+{
+    double best = 1e30;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fill(points);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    printStats(name, shape, points, best);
+}
+
+// what random_in_unit_sphere() was
+inline vec3 rejection_ball(Rng &rng)
+{
+    vec3 p;
+    do
+    {
+        p = 2.0f * vec3(rng.next_float(), rng.next_float(), rng.next_float()) - vec3(1, 1, 1);
+    } while (p.squared_length() >= 1.0f);
+    return p;
+}
+
+// WIDTH numbers each for u and v, and for w too if there are three
+template<int WIDTH>
+struct Uniforms
+{
+    alignas(32) float u[WIDTH], v[WIDTH], w[WIDTH];
+    Uniforms(Rng &rng, int numDims)
+    {
+        for (int lane = 0; lane < WIDTH; lane++)
+        {
+            u[lane] = rng.next_float();
+            v[lane] = rng.next_float();
+            w[lane] = (numDims > 2)? rng.next_float() : 0.0f;
+        }
+    }
+};
+
+// the lanes out to consecutive vec3's
+#if BENCH_SIMD
+inline void store(const vec3x4 &v, vec3 *pOut)
+{
+    alignas(16) float xs[4], ys[4], zs[4];
+    _mm_store_ps(xs, v.x); _mm_store_ps(ys, v.y); _mm_store_ps(zs, v.z);
+    for (int lane = 0; lane < 4; lane++) pOut[lane] = vec3(xs[lane], ys[lane], zs[lane]);
+}
+
+#ifdef __AVX__
+inline void store(const vec3x8 &v, vec3 *pOut)
+{
+    alignas(32) float xs[8], ys[8], zs[8];
+    _mm256_store_ps(xs, v.x); _mm256_store_ps(ys, v.y); _mm256_store_ps(zs, v.z);
+    for (int lane = 0; lane < 8; lane++) pOut[lane] = vec3(xs[lane], ys[lane], zs[lane]);
+}
+#endif
+#endif
+
+int BENCH_TREE_FN(sampling)(int argc, char **argv)
+{
+    const size_t n = ((argc > 1)? atoi(argv[1]) : 4 << 20) & ~size_t(7);
+
+    const vec3 normal(0, 0, 1);
+    std::vector<vec3> points(n);
+
+    printf("%d points, best of %d runs\n", (int)n, NUM_RUNS);
+
+    printf("ball\n");
+    bench("rejection", Shape::Ball, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) p[i] = rejection_ball(rng);
+    });
+    bench("direct", Shape::Ball, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) { Uniforms<1> r(rng, 3); p[i] = uniform_ball(r.u[0], r.v[0], r.w[0]); }
+    });
+#if BENCH_SIMD
+    bench("direct, x4", Shape::Ball, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i += 4)
+        {
+            Uniforms<4> r(rng, 3);
+            const vec3x4 b = uniform_ball(_mm_load_ps(r.u), _mm_load_ps(r.v), _mm_load_ps(r.w));
+            store(b, &p[i]);
+        }
+    });
+#ifdef __AVX__
+    bench("direct, x8", Shape::Ball, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i += 8)
+        {
+            Uniforms<8> r(rng, 3);
+            const vec3x8 b = uniform_ball(_mm256_load_ps(r.u), _mm256_load_ps(r.v), _mm256_load_ps(r.w));
+            store(b, &p[i]);
+        }
+    });
+#endif
+#endif
+
+    printf("sphere\n");
+    bench("rejection, normalized", Shape::Sphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) p[i] = normalize(rejection_ball(rng));
+    });
+    bench("direct", Shape::Sphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) { Uniforms<1> r(rng, 2); p[i] = uniform_sphere(r.u[0], r.v[0]); }
+    });
+#if BENCH_SIMD
+    bench("direct, x4", Shape::Sphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i += 4)
+        {
+            Uniforms<4> r(rng, 2);
+            const vec3x4 s = uniform_sphere(_mm_load_ps(r.u), _mm_load_ps(r.v));
+            store(s, &p[i]);
+        }
+    });
+#ifdef __AVX__
+    bench("direct, x8", Shape::Sphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i += 8)
+        {
+            Uniforms<8> r(rng, 2);
+            const vec3x8 s = uniform_sphere(_mm256_load_ps(r.u), _mm256_load_ps(r.v));
+            store(s, &p[i]);
+        }
+    });
+#endif
+#endif
+
+    printf("hemisphere\n");
+    bench("rejection (old diffuse)", Shape::Hemisphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) p[i] = normal + rejection_ball(rng);
+    });
+    bench("direct", Shape::Hemisphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        for (size_t i = 0; i < n; i++) { Uniforms<1> r(rng, 2); p[i] = cosine_hemisphere(normal, r.u[0], r.v[0]); }
+    });
+#if BENCH_SIMD
+    bench("direct, x4", Shape::Hemisphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        const vec3x4 normals(normal);
+        for (size_t i = 0; i < n; i += 4)
+        {
+            Uniforms<4> r(rng, 2);
+            const vec3x4 d = cosine_hemisphere(normals, _mm_load_ps(r.u), _mm_load_ps(r.v));
+            store(d, &p[i]);
+        }
+    });
+#ifdef __AVX__
+    bench("direct, x8", Shape::Hemisphere, points, [&](std::vector<vec3> &p) {
+        Rng rng(1);
+        const vec3x8 normals(normal);
+        for (size_t i = 0; i < n; i += 8)
+        {
+            Uniforms<8> r(rng, 2);
+            const vec3x8 d = cosine_hemisphere(normals, _mm256_load_ps(r.u), _mm256_load_ps(r.v));
+            store(d, &p[i]);
+        }
+    });
+#endif
+#endif
+
+    return 0;
+}
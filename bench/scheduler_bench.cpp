@@ -0,0 +1,101 @@
+// Compares the ThreadPool scheduling modes on the main.cpp scene.
+//
+// For each mode the whole frame is rendered a few times, and for each run it
+// records when every thread ran out of tiles. The interesting number is the
+// tail: the gap between the first thread going idle and the last tile
+// finishing. With a shared counter the tail is however long the unluckiest
+// last tile takes; with work stealing it should shrink to roughly one tile.
+
+#include "bench_tree.h"
+
+#define NUM_RUNS 5
+
+struct runStats
+{
+    double wall;         // start() until every thread is done
+    double firstIdle;    // first thread to find no work left
+    double lastFinish;   // last tile finished
+};
+
+runStats runOnce(ThreadPool &pool)
+{
+    pool.clear();
+    auto start = std::chrono::steady_clock::now();
+    pool.start();
+    pool.waitUntilDone();
+    pool.stop();
+    auto stop = std::chrono::steady_clock::now();
+
+    runStats s;
+    s.wall = std::chrono::duration<double>(stop - start).count();
+    s.firstIdle = pool.threadFinishSeconds(0);
+    s.lastFinish = pool.threadFinishSeconds(0);
+    for (uint32_t i = 1; i < pool.getNumThreads(); i++)
+    {
+        double t = pool.threadFinishSeconds(i);
+        if (t < s.firstIdle) s.firstIdle = t;
+        if (t > s.lastFinish) s.lastFinish = t;
+    }
+    return s;
+}
+
+void benchMode(const char *name, Scheduling mode, threadInfo *pInfo)
+{
+    // as many threads as the pool allows, since balance is what's measured
+    ThreadPool pool(std::thread::hardware_concurrency(), mode);
+    pool.init(pInfo);
+
+    double wall = 0, last = 0, tail = 0, worstTail = 0;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        runStats s = runOnce(pool);
+        wall += s.wall;
+        last += s.lastFinish;
+        tail += s.lastFinish - s.firstIdle;
+        if (s.lastFinish - s.firstIdle > worstTail) worstTail = s.lastFinish - s.firstIdle;
+    }
+    printf("%-14s  wall %7.3fs   last tile %7.3fs   tail %7.4fs (worst %7.4fs)\n",
+        name, wall / NUM_RUNS, last / NUM_RUNS, tail / NUM_RUNS, worstTail);
+}
+
+// takes no arguments; bench_main.cpp passes them to every benchmark
+int BENCH_TREE_FN(scheduler)(int, char **)
+{
+    MaterialTable materials;
+    Hitable *dList[9];
+    dList[0] = new Sphere(vec3( 0,   100.6, -2  ), 100, materials.add(Diffuse(   vec3(0.3, 0.5, 0.7)                )));
+    dList[1] = new Sphere(vec3( 0,     0,   -2  ), 0.5, materials.add(Diffuse(   vec3(0.8, 0.3, 0.3)                )));
+    dList[2] = new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, materials.add(Metal(     vec3(0.7, 0.7, 0.7),   0.4         )));
+    dList[3] = new Sphere(vec3( 1,     0,   -2  ), 0.4, materials.add(Metal(     vec3(0.3, 0.4, 0.9),   0.05        )));
+    dList[4] = new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, materials.add(Glass(     vec3(0.5, 1.0, 0.6),   0.9         )));
+    dList[5] = new Sphere(vec3( 0,     0.2,  1  ), 0.3, materials.add(Glass(     vec3(0.8, 0.2, 0.3),   0.0         )));
+    dList[6] = new Sphere(vec3(-1,    -0.3, -1.2), 0.2, materials.add(Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false )));
+    dList[7] = new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, materials.add(Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false )));
+    dList[8] = new Sphere(vec3( 0,    -5.0, -3  ), 2.0, materials.add(Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false )));
+    Hitable *pWorld = new HitableList(dList, 9);
+
+    Camera cam(
+            vec3(-1,0,2),
+            vec3(0,0,-1),
+            vec3(0,1,0),
+            70,
+            (float)WINDOW_WIDTH/WINDOW_HEIGHT
+        );
+
+    PixelStats *pAccumBuffer = new PixelStats[WINDOW_WIDTH * WINDOW_HEIGHT];
+    uint32_t *pFrameBuffer = new uint32_t[WINDOW_WIDTH * WINDOW_HEIGHT];
+    // no light list: this is about how the tiles get shared out, and the
+    // plain bounces are enough to make their costs uneven
+    threadInfo info { pWorld, &materials, nullptr, &cam, pAccumBuffer, pFrameBuffer };
+
+    printf("%dx%d, %dx%d tiles, %d samples, %d runs each\n",
+        WINDOW_WIDTH, WINDOW_HEIGHT, TILE_WIDTH, TILE_HEIGHT, NUM_ALIAS_STEPS, NUM_RUNS);
+    benchMode("shared counter", Scheduling::SharedCounter, &info);
+    benchMode("work stealing",  Scheduling::WorkStealing,  &info);
+
+    delete[] pAccumBuffer;
+    delete[] pFrameBuffer;
+    delete pWorld;
+    for (Hitable *pSphere : dList) delete pSphere;
+    return 0;
+}
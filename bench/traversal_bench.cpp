@@ -0,0 +1,143 @@
+// Compares the binary BVH against the 4- and 8-wide ones, on just finding
+// the closest hit (no shading).
+//
+// The scene is main.cpp's spheres plus a field of small ones over the
+// ground, like NUM_EXTRA_SPHERES; how many is the first argument (100000 by
+// default). Two sets of rays are traced through each structure: camera rays
+// for every pixel, which are coherent, and one diffuse bounce from wherever
+// each of those landed, which aren't. The camera rays are also traced as
+// PACKET_WIDTH x PACKET_HEIGHT packets. Every structure's answers are checked
+// against the binary BVH's.
+
+#include "bench_tree.h"
+
+#define NUM_RUNS 3
+
+// t of the closest hit for each ray, or -1
+void traceAll(const Hitable *pAccel, const std::vector<ray> &rays, std::vector<float> &ts)
+{
+    ts.resize(rays.size());
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        hit_record rec;
+        ts[i] = pAccel->hit(rays[i], 0.001f, FLT_MAX, rec)? rec.t : -1;
+    }
+}
+
+// the same, but handing the rays over a packet at a time; rays has to be
+// whole packets, one after the other
+void traceAllPackets(const Hitable *pAccel, const std::vector<ray> &rays, std::vector<float> &ts)
+{
+    ts.resize(rays.size());
+    RayPacket packet;
+    hit_record recs[PACKET_SIZE];
+    for (size_t first = 0; first < rays.size(); first += PACKET_SIZE)
+    {
+        for (int i = 0; i < PACKET_SIZE; i++) packet.set(i, rays[first + i]);
+        pAccel->hit_packet(packet, 0.001f, recs);
+        for (int i = 0; i < PACKET_SIZE; i++)
+            ts[first + i] = (packet.tMax[i] < FLT_MAX)? packet.tMax[i] : -1;
+    }
+}
+
+void benchAccel(const char *name, const Hitable *pAccel, const std::vector<ray> &rays,
+                const std::vector<float> &reference, bool packets = false)
+{
+    std::vector<float> ts;
+    double best = 1e30;
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (packets) traceAllPackets(pAccel, rays, ts);
+        else traceAll(pAccel, rays, ts);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+
+    int mismatches = 0;
+    for (size_t i = 0; i < ts.size(); i++)
+        if (fabs(ts[i] - reference[i]) > 1e-4f * (1 + fabs(reference[i]))) mismatches++;
+    printf("  %-6s %8.3f Mrays/s  (%.3fs)", name, rays.size() / best / 1e6, best);
+    if (mismatches) printf("   %d MISMATCHES", mismatches);
+    printf("\n");
+}
+
+int BENCH_TREE_FN(traversal)(int argc, char **argv)
+{
+    const int numExtra = (argc > 1)? atoi(argv[1]) : 100000;
+
+    MaterialTable materials;
+    std::vector<Sphere*> dList;
+    dList.push_back(new Sphere(vec3( 0,   100.6, -2  ), 100, materials.add(Diffuse(   vec3(0.3, 0.5, 0.7)                ))));
+    dList.push_back(new Sphere(vec3( 0,     0,   -2  ), 0.5, materials.add(Diffuse(   vec3(0.8, 0.3, 0.3)                ))));
+    dList.push_back(new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, materials.add(Metal(     vec3(0.7, 0.7, 0.7),   0.4         ))));
+    dList.push_back(new Sphere(vec3( 1,     0,   -2  ), 0.4, materials.add(Metal(     vec3(0.3, 0.4, 0.9),   0.05        ))));
+    dList.push_back(new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, materials.add(Glass(     vec3(0.5, 1.0, 0.6),   0.9         ))));
+    dList.push_back(new Sphere(vec3( 0,     0.2,  1  ), 0.3, materials.add(Glass(     vec3(0.8, 0.2, 0.3),   0.0         ))));
+    dList.push_back(new Sphere(vec3(-1,    -0.3, -1.2), 0.2, materials.add(Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, materials.add(Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false ))));
+    dList.push_back(new Sphere(vec3( 0,    -5.0, -3  ), 2.0, materials.add(Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false ))));
+
+    Rng sceneRng(1);
+    const uint32_t ground = materials.add(Diffuse(vec3(0.5, 0.5, 0.5)));
+    for (int i = 0; i < numExtra; i++)
+    {
+        const float x = 24.0f * sceneRng.next_float() - 12.0f;
+        const float z = -14.0f * sceneRng.next_float() + 1.5f;
+        const float r = 0.02f + 0.06f * sceneRng.next_float();
+        const float groundY = 100.6f - sqrt(100.0f*100.0f - x*x - (z+2)*(z+2));
+        dList.push_back(new Sphere(vec3(x, groundY - r, z), r, ground));
+    }
+
+    ThreadPool pool(std::thread::hardware_concurrency());
+    BVH bvh2(dList.data(), dList.size(), &pool);
+    WideBVH<4> bvh4(dList.data(), dList.size(), &pool);
+    WideBVH<8> bvh8(dList.data(), dList.size(), &pool);
+
+    Camera cam(
+            vec3(-1,0,2),
+            vec3(0,0,-1),
+            vec3(0,1,0),
+            70,
+            (float)WINDOW_WIDTH/WINDOW_HEIGHT
+        );
+
+    // camera rays go in packet order: each PACKET_WIDTH x PACKET_HEIGHT block
+    // of pixels in turn (the image is cropped to whole packets)
+    std::vector<ray> primary, bounce;
+    // one long run of plain random numbers, with no dimensions to keep in step
+    Sampler sampler(SamplerKind::Random, 0, 0, 2);
+    for (int py = 0; py + PACKET_HEIGHT <= WINDOW_HEIGHT; py += PACKET_HEIGHT)
+        for (int px = 0; px + PACKET_WIDTH <= WINDOW_WIDTH; px += PACKET_WIDTH)
+            for (int i = 0; i < PACKET_SIZE; i++)
+            {
+                const int x = px + i % PACKET_WIDTH, y = py + i / PACKET_WIDTH;
+                ray r = cam.getRay(float(x) / WINDOW_WIDTH, float(y) / WINDOW_HEIGHT);
+                primary.push_back(r);
+                hit_record rec;
+                if (bvh2.hit(r, 0.001f, FLT_MAX, rec))
+                    bounce.push_back(ray(rec.p, rec.normal + random_in_unit_sphere(sampler)));
+            }
+
+    printf("%d spheres: %u binary nodes, %u 4-wide, %u 8-wide\n", (int)dList.size(),
+        bvh2.numNodes(), bvh4.numNodes(), bvh8.numNodes());
+
+    std::vector<float> reference;
+    printf("camera rays (%d):\n", (int)primary.size());
+    traceAll(&bvh2, primary, reference);
+    benchAccel("bvh2", &bvh2, primary, reference);
+    benchAccel("bvh4", &bvh4, primary, reference);
+    benchAccel("bvh8", &bvh8, primary, reference);
+    printf("camera ray packets (%dx%d):\n", PACKET_WIDTH, PACKET_HEIGHT);
+    benchAccel("bvh2", &bvh2, primary, reference, true);
+    benchAccel("bvh4", &bvh4, primary, reference, true);
+    benchAccel("bvh8", &bvh8, primary, reference, true);
+
+    printf("diffuse bounce rays (%d):\n", (int)bounce.size());
+    traceAll(&bvh2, bounce, reference);
+    benchAccel("bvh2", &bvh2, bounce, reference);
+    benchAccel("bvh4", &bvh4, bounce, reference);
+    benchAccel("bvh8", &bvh8, bounce, reference);
+
+    return 0;
+}
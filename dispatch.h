@@ -0,0 +1,67 @@
+#ifndef DISPATCHH
+#define DISPATCHH
+
+#include <stdio.h>
+#include <initializer_list>
+
+#include "settings.h"
+#include "renderer.h"
+
+// Picks the build of the tracer to run, at startup, from what the CPU says
+// it can do. The SIMD builds are each compiled for their own instruction set
+// and would die on an illegal instruction anywhere else, so the scalar one
+// is the only one that's always safe; Backend::Auto takes the widest one
+// that is.
+//
+// Only main.cpp includes this. Everything in it has to stay out of the
+// files built with -mavx2 and friends, or the compiler is free to use those
+// instructions in the very code that checks whether it can.
+
+// whether this CPU (and the OS, for the wider registers) can run it.
+// __builtin_cpu_supports() reads CPUID, and XGETBV for what the OS saves.
+inline bool backend_supported(Backend backend)
+{
+    __builtin_cpu_init();
+    switch (backend)
+    {
+        case Backend::Auto:
+        case Backend::Scalar: return true;
+        case Backend::SSE:    return __builtin_cpu_supports("sse4.1");
+        case Backend::AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case Backend::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                                     __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw") &&
+                                     __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    return false;
+}
+
+// the widest one this CPU can run
+inline Backend best_backend()
+{
+    for (Backend b : { Backend::AVX512, Backend::AVX2, Backend::SSE })
+        if (backend_supported(b)) return b;
+    return Backend::Scalar;
+}
+
+// the renderer for settings.backend, with Auto resolved. null, after saying
+// why, if the CPU can't run the one that was asked for.
+inline Renderer *make_renderer(const RenderSettings &settings)
+{
+    Backend backend = settings.backend;
+    if (backend == Backend::Auto) backend = best_backend();
+    if (!backend_supported(backend))
+    {
+        fprintf(stderr, "This CPU can't run the %s backend (the best it can do is %s).\n",
+                backend_name(backend), backend_name(best_backend()));
+        return nullptr;
+    }
+    switch (backend)
+    {
+        case Backend::SSE:    return make_simd_sse_renderer(settings);
+        case Backend::AVX2:   return make_simd_avx2_renderer(settings);
+        case Backend::AVX512: return make_simd_avx512_renderer(settings);
+        default:              return make_float_renderer(settings);
+    }
+}
+
+#endif
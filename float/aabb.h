@@ -0,0 +1,88 @@
+#ifndef AABBH
+#define AABBH
+
+#include <cfloat>
+#include <cmath>
+
+#include "vector.h"
+#include "../ray.h"
+
+// Axis-aligned bounding box, i.e. the smallest box (with sides parallel to
+// the axes) that something fits in. Cheap to test a ray against, so they're
+// what the BVH is made of.
+
+class aabb
+{
+public:
+    // starts out "inside out", so growing it by anything gives that thing's box
+    aabb() : minimum(FLT_MAX, FLT_MAX, FLT_MAX), maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+    aabb(const vec3 &a, const vec3 &b) : minimum(a), maximum(b) {}
+
+    inline void grow(const vec3 &p);
+    inline void grow(const aabb &b);
+    inline vec3 centroid() const { return 0.5f * (minimum + maximum); }
+    inline float surface_area() const;
+    inline int longest_axis() const;
+
+    vec3 minimum;
+    vec3 maximum;
+};
+
+// plain compares rather than fminf/fmaxf; those have to handle NaN, so they
+// don't boil down to a single min/max instruction
+inline void aabb::grow(const vec3 &p)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        minimum[i] = (p[i] < minimum[i])? p[i] : minimum[i];
+        maximum[i] = (p[i] > maximum[i])? p[i] : maximum[i];
+    }
+}
+
+inline void aabb::grow(const aabb &b)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        minimum[i] = (b.minimum[i] < minimum[i])? b.minimum[i] : minimum[i];
+        maximum[i] = (b.maximum[i] > maximum[i])? b.maximum[i] : maximum[i];
+    }
+}
+
+inline float aabb::surface_area() const
+{
+    const vec3 d = maximum - minimum;
+    // an empty box has max < min; call that zero
+    if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+    return 2.0f * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+inline int aabb::longest_axis() const
+{
+    const vec3 d = maximum - minimum;
+    if (d.x() > d.y() && d.x() > d.z()) return 0;
+    return (d.y() > d.z())? 1 : 2;
+}
+
+// "slab" test: clip the ray's [tMin,tMax] against the pair of planes on each
+// axis in turn; if anything's left over, the ray goes through the box.
+// invDir is 1/direction, worked out once per ray. returns the distance at
+// which the ray enters the box in tEntry.
+inline bool slab_test(const float *bmin, const float *bmax, const vec3 &origin, const vec3 &invDir,
+                      float tMin, float tMax, float &tEntry)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        float t0 = (bmin[i] - origin[i]) * invDir[i];
+        float t1 = (bmax[i] - origin[i]) * invDir[i];
+        if (t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+        // written so a NaN (0 * inf, for a ray lying exactly in a slab
+        // plane) leaves tMin/tMax alone
+        tMin = (t0 > tMin)? t0 : tMin;
+        tMax = (t1 < tMax)? t1 : tMax;
+        if (tMax < tMin) return false;
+    }
+    tEntry = tMin;
+    return true;
+}
+
+#endif
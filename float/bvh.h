@@ -0,0 +1,602 @@
+#ifndef BVHH
+#define BVHH
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "vector.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "aabb.h"
+#include "wavefront.h"      // and what it includes, for ../thread_pool.h
+#include "../thread_pool.h"
+
+// Bounding volume hierarchy over a set of spheres. Spheres are grouped into a
+// tree of boxes, so a ray only has to look at the spheres whose boxes it goes
+// through instead of every sphere in the scene; that's about O(log n) per ray
+// instead of O(n).
+//
+// The tree is built top-down with the surface area heuristic (SAH): every
+// split is placed where it minimizes the expected cost of a random ray, which
+// is proportional to the surface area of each side times the number of
+// spheres on it. Candidate splits are the boundaries between BVH_NUM_BINS
+// equal-width bins along each axis.
+//
+// Nodes are flattened into one array, 32 bytes each (two per cache line),
+// with both children of a node stored next to each other. intersect() walks it
+// with a small explicit stack instead of recursing. The spheres themselves
+// are in a SphereBatch, one group per leaf, so a leaf is tested in one go
+// with its kernel rather than one sphere at a time.
+//
+// Given a ThreadPool, the build runs in parallel in two stages. Near the top
+// of the tree there are only a few nodes, each with lots of spheres, so the
+// work inside a node gets split up: all the nodes on one level are binned
+// and partitioned together, in chunks of BVH_BUILD_CHUNK spheres spread over
+// the threads. Once nodes are small enough, each one becomes a task that
+// builds its whole subtree on a single thread, and the subtrees get stitched
+// into the main node array at the end.
+
+#define BVH_NUM_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_TRAVERSAL_COST 1.0f    // relative to one ray-sphere test
+#define BVH_STACK_SIZE 128
+// past this depth, splits fall back to halving the node at its median, which
+// keeps the tree (and so the traversal stack) from getting too deep on
+// strange scenes
+#define BVH_MAX_SAH_DEPTH 64
+// parallel build: spheres per chunk in the top levels, and the smallest node
+// that's worth handing out as a subtree task
+#define BVH_BUILD_CHUNK 8192
+#define BVH_MIN_SUBTREE 1024
+
+struct BVHNode
+{
+    float bmin[3];
+    uint32_t leftOrFirst;   // interior: index of left child (right is +1); leaf: first sphere
+    float bmax[3];
+    uint32_t count;         // number of spheres; 0 for interior nodes
+
+    bool isLeaf() const { return count > 0; }
+};
+
+class BVH : public Hitable
+{
+public:
+    BVH() {}
+    BVH(Sphere **list, int n, ThreadPool *pPool = nullptr);
+
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+
+    uint32_t numNodes() const { return m_nodes.size(); }
+    uint32_t numSpheres() const { return m_leaves.size(); }
+    // for building other structures (like WideBVH) on top of this one
+    const std::vector<BVHNode> &nodes() const { return m_nodes; }
+    const SphereBatch &leaves() const { return m_leaves; }
+
+private:
+    // a node that's yet to be split (top levels of a parallel build), or a
+    // subtree to be built by one thread
+    struct BuildJob
+    {
+        uint32_t node, first, count;
+        int depth;
+        aabb centroidBounds;
+        int axis, split;    // what to split on; axis -1 means at the median position
+        uint32_t mid;
+        aabb childBounds[2], childCentroids[2];
+    };
+    // BVH_BUILD_CHUNK spheres of one job, for the top levels
+    struct BuildChunk
+    {
+        uint32_t job, start, end;
+        aabb binBounds[3][BVH_NUM_BINS];
+        uint32_t binCount[3][BVH_NUM_BINS];
+        uint32_t numLeft, leftOffset, rightOffset;
+        aabb childBounds[2], childCentroids[2];
+    };
+
+    void m_build(std::vector<BVHNode> &nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth);
+    void m_buildParallel(ThreadPool &pool, uint32_t n);
+    void m_bin(uint32_t first, uint32_t end, const aabb &centroidBounds,
+               aabb binBounds[3][BVH_NUM_BINS], uint32_t binCount[3][BVH_NUM_BINS]) const;
+    float m_bestSplit(const aabb binBounds[3][BVH_NUM_BINS], const uint32_t binCount[3][BVH_NUM_BINS],
+                      int &bestAxis, int &bestSplit) const;
+    bool m_goesLeft(const vec3 &centroid, const aabb &centroidBounds, int axis, int split) const;
+    void m_setBounds(BVHNode &node, const aabb &box);
+
+    std::vector<BVHNode> m_nodes;
+    SphereBatch m_leaves;    // one group per leaf, in tree order; leaves index into this
+
+    // scratch space, only used while building. the spheres' boxes get
+    // shuffled around along with their indices, rather than just the
+    // indices, so every pass over a node reads memory in order.
+    struct BuildPrim
+    {
+        aabb bounds;
+        vec3 centroid;
+        uint32_t index;
+    };
+    std::vector<BuildPrim> m_prims;
+    std::vector<BuildPrim> m_primsTmp;
+};
+
+
+BVH::BVH(Sphere **list, int n, ThreadPool *pPool)
+{
+    // without a pool, "parallel" loops just run on this thread
+    auto forChunks = [&](uint32_t count, const std::function<void(uint32_t)> &fn) {
+        if (pPool) pPool->parallel_for(count, fn);
+        else for (uint32_t i = 0; i < count; i++) fn(i);
+    };
+    const uint32_t numChunks = (n + BVH_BUILD_CHUNK - 1) / BVH_BUILD_CHUNK;
+
+    m_prims.resize(n);
+    forChunks(numChunks, [&](uint32_t c) {
+        const int end = std::min(n, int(c + 1) * BVH_BUILD_CHUNK);
+        for (int i = c * BVH_BUILD_CHUNK; i < end; i++)
+        {
+            const vec3 r(list[i]->radius, list[i]->radius, list[i]->radius);
+            m_prims[i].bounds = aabb(list[i]->center - r, list[i]->center + r);
+            m_prims[i].centroid = list[i]->center;
+            m_prims[i].index = i;
+        }
+    });
+
+    // a binary tree with n leaves has 2n-1 nodes, so this never reallocates
+    m_nodes.reserve(2*n > 0 ? 2*n - 1 : 1);
+    m_nodes.push_back(BVHNode());
+    if (n == 0) m_setBounds(m_nodes[0], aabb());
+    else if (pPool && n > 2*BVH_MIN_SUBTREE) m_buildParallel(*pPool, n);
+    else m_build(m_nodes, 0, 0, n, 0);
+
+    // give every leaf its own group in m_leaves, in the order the leaves
+    // have their spheres in m_prims, then copy the spheres in
+    std::vector<uint32_t> leafNodes;
+    for (uint32_t i = 0; i < m_nodes.size(); i++)
+        if (m_nodes[i].isLeaf()) leafNodes.push_back(i);
+    std::sort(leafNodes.begin(), leafNodes.end(),
+              [&](uint32_t a, uint32_t b) { return m_nodes[a].leftOrFirst < m_nodes[b].leftOrFirst; });
+    std::vector<uint32_t> primFirst(leafNodes.size());
+    for (uint32_t k = 0; k < leafNodes.size(); k++)
+    {
+        BVHNode &leaf = m_nodes[leafNodes[k]];
+        primFirst[k] = leaf.leftOrFirst;
+        leaf.leftOrFirst = m_leaves.addGroup(leaf.count);
+    }
+    forChunks((leafNodes.size() + BVH_BUILD_CHUNK - 1) / BVH_BUILD_CHUNK, [&](uint32_t c) {
+        const uint32_t end = std::min<uint32_t>(leafNodes.size(), (c + 1) * BVH_BUILD_CHUNK);
+        for (uint32_t k = c * BVH_BUILD_CHUNK; k < end; k++)
+        {
+            const BVHNode &leaf = m_nodes[leafNodes[k]];
+            for (uint32_t i = 0; i < leaf.count; i++)
+                m_leaves.set(leaf.leftOrFirst + i, *list[m_prims[primFirst[k] + i].index]);
+        }
+    });
+
+    m_prims = std::vector<BuildPrim>();
+    m_primsTmp = std::vector<BuildPrim>();
+}
+
+void BVH::m_setBounds(BVHNode &node, const aabb &box)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        node.bmin[i] = box.minimum[i];
+        node.bmax[i] = box.maximum[i];
+    }
+}
+
+// bins spheres [first,end) of m_prims by centroid, on all three axes at once
+void BVH::m_bin(uint32_t first, uint32_t end, const aabb &centroidBounds,
+                aabb binBounds[3][BVH_NUM_BINS], uint32_t binCount[3][BVH_NUM_BINS]) const
+{
+    float lo[3], scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        lo[axis] = centroidBounds.minimum[axis];
+        const float extent = centroidBounds.maximum[axis] - lo[axis];
+        scale[axis] = (extent > 0)? BVH_NUM_BINS / extent : 0;
+    }
+    for (uint32_t i = first; i < end; i++)
+    {
+        const BuildPrim &p = m_prims[i];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const int bin = std::min(BVH_NUM_BINS - 1, int((p.centroid[axis] - lo[axis]) * scale[axis]));
+            binBounds[axis][bin].grow(p.bounds);
+            binCount[axis][bin]++;
+        }
+    }
+}
+
+// sweeps the bins from both ends to get the cost of splitting at each bin
+// boundary, and returns the cheapest. bestAxis is left at -1 if there's no
+// split with something on both sides.
+float BVH::m_bestSplit(const aabb binBounds[3][BVH_NUM_BINS], const uint32_t binCount[3][BVH_NUM_BINS],
+                       int &bestAxis, int &bestSplit) const
+{
+    float bestCost = FLT_MAX;
+    bestAxis = -1;
+    bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float leftArea[BVH_NUM_BINS - 1];
+        uint32_t leftCount[BVH_NUM_BINS - 1];
+        aabb box;
+        uint32_t n = 0;
+        for (int b = 0; b < BVH_NUM_BINS - 1; b++)
+        {
+            box.grow(binBounds[axis][b]);
+            n += binCount[axis][b];
+            leftArea[b] = box.surface_area();
+            leftCount[b] = n;
+        }
+        box = aabb();
+        n = 0;
+        for (int b = BVH_NUM_BINS - 1; b > 0; b--)
+        {
+            box.grow(binBounds[axis][b]);
+            n += binCount[axis][b];
+            // split between bin b-1 and bin b
+            const float cost = leftArea[b-1]*leftCount[b-1] + box.surface_area()*n;
+            if (leftCount[b-1] > 0 && n > 0 && cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+    return bestCost;
+}
+
+inline bool BVH::m_goesLeft(const vec3 &centroid, const aabb &centroidBounds, int axis, int split) const
+{
+    const float lo = centroidBounds.minimum[axis];
+    const float scale = BVH_NUM_BINS / (centroidBounds.maximum[axis] - lo);
+    return std::min(BVH_NUM_BINS - 1, int((centroid[axis] - lo) * scale)) < split;
+}
+
+// builds the subtree under nodes[nodeIndex] from spheres [first,first+count)
+// of m_prims, adding new nodes to the end of nodes
+void BVH::m_build(std::vector<BVHNode> &nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth)
+{
+    aabb bounds, centroidBounds;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        bounds.grow(m_prims[i].bounds);
+        centroidBounds.grow(m_prims[i].centroid);
+    }
+    m_setBounds(nodes[nodeIndex], bounds);
+    nodes[nodeIndex].leftOrFirst = first;
+    nodes[nodeIndex].count = count;
+    if (count == 1) return;
+
+    // bin every sphere by its centroid on each axis. an axis where all the
+    // centroids are in one plane puts everything in bin 0, so it never
+    // offers a split.
+    float bestCost = FLT_MAX;
+    int bestAxis = -1, bestSplit = 0;
+    if (depth < BVH_MAX_SAH_DEPTH)
+    {
+        aabb binBounds[3][BVH_NUM_BINS];
+        uint32_t binCount[3][BVH_NUM_BINS] = {{0}};
+        m_bin(first, first + count, centroidBounds, binBounds, binCount);
+        bestCost = m_bestSplit(binBounds, binCount, bestAxis, bestSplit);
+    }
+
+    // is it actually worth splitting? compare against just testing every
+    // sphere in this node. either way, huge leaves get split regardless.
+    const float area = bounds.surface_area();
+    const float splitCost = BVH_TRAVERSAL_COST + ((area > 0)? bestCost / area : 0);
+    if (bestAxis < 0)
+    {
+        // too deep, or every centroid is in the same spot so binning is
+        // hopeless
+        if (count <= BVH_MAX_LEAF_SIZE) return;
+    }
+    else if (splitCost >= count && count <= BVH_MAX_LEAF_SIZE) return;
+
+    uint32_t mid;
+    if (bestAxis < 0)
+    {
+        // cut it in half at the median centroid along the longest axis
+        const int axis = centroidBounds.longest_axis();
+        mid = first + count/2;
+        std::nth_element(&m_prims[first], &m_prims[mid], &m_prims[first] + count,
+            [&](const BuildPrim &a, const BuildPrim &b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+    else
+    {
+        BuildPrim *pMid = std::partition(&m_prims[first], &m_prims[first] + count,
+            [&](const BuildPrim &p) { return m_goesLeft(p.centroid, centroidBounds, bestAxis, bestSplit); });
+        mid = pMid - &m_prims[0];
+    }
+
+    const uint32_t left = nodes.size();
+    nodes.push_back(BVHNode());
+    nodes.push_back(BVHNode());
+    nodes[nodeIndex].leftOrFirst = left;
+    nodes[nodeIndex].count = 0;
+    m_build(nodes, left,     first, mid - first,         depth + 1);
+    m_build(nodes, left + 1, mid,   first + count - mid, depth + 1);
+}
+
+void BVH::m_buildParallel(ThreadPool &pool, uint32_t n)
+{
+    // aim for a good few subtrees per thread, so they balance out even
+    // though they come in all sizes
+    const uint32_t subtreeSize = std::max<uint32_t>(BVH_MIN_SUBTREE, n / (8 * pool.getNumThreads()));
+    m_primsTmp.resize(n);
+
+    // the root's centroid bounds, to bin against
+    BuildJob root {};
+    root.count = n;
+    {
+        std::vector<aabb> chunkBounds((n + BVH_BUILD_CHUNK - 1) / BVH_BUILD_CHUNK);
+        pool.parallel_for(chunkBounds.size(), [&](uint32_t c) {
+            const uint32_t end = std::min(n, (c + 1) * BVH_BUILD_CHUNK);
+            for (uint32_t i = c * BVH_BUILD_CHUNK; i < end; i++)
+                chunkBounds[c].grow(m_prims[i].centroid);
+        });
+        for (const aabb &b : chunkBounds) root.centroidBounds.grow(b);
+    }
+
+    std::vector<BuildJob> level(1, root), subtrees;
+    std::vector<BuildChunk> chunks;
+    while (!level.empty())
+    {
+        chunks.clear();
+        for (uint32_t j = 0; j < level.size(); j++)
+            for (uint32_t i = level[j].first; i < level[j].first + level[j].count; i += BVH_BUILD_CHUNK)
+            {
+                BuildChunk c {};
+                c.job = j;
+                c.start = i;
+                c.end = std::min(i + BVH_BUILD_CHUNK, level[j].first + level[j].count);
+                chunks.push_back(c);
+            }
+
+        // bin every chunk, then add the chunks up to pick each node's split.
+        // every node here is far bigger than a leaf, so it always gets split.
+        pool.parallel_for(chunks.size(), [&](uint32_t c) {
+            BuildChunk &chunk = chunks[c];
+            m_bin(chunk.start, chunk.end, level[chunk.job].centroidBounds, chunk.binBounds, chunk.binCount);
+        });
+        for (uint32_t j = 0, c = 0; j < level.size(); j++)
+        {
+            BuildJob &job = level[j];
+            aabb binBounds[3][BVH_NUM_BINS];
+            uint32_t binCount[3][BVH_NUM_BINS] = {{0}};
+            aabb bounds;
+            for (; c < chunks.size() && chunks[c].job == j; c++)
+                for (int axis = 0; axis < 3; axis++)
+                    for (int b = 0; b < BVH_NUM_BINS; b++)
+                    {
+                        binBounds[axis][b].grow(chunks[c].binBounds[axis][b]);
+                        binCount[axis][b] += chunks[c].binCount[axis][b];
+                    }
+            for (int b = 0; b < BVH_NUM_BINS; b++) bounds.grow(binBounds[0][b]);
+            m_setBounds(m_nodes[job.node], bounds);
+
+            job.axis = -1;
+            if (job.depth < BVH_MAX_SAH_DEPTH)
+                m_bestSplit(binBounds, binCount, job.axis, job.split);
+            job.mid = job.first + job.count/2;
+            if (job.axis < 0)
+            {
+                // same median fallback as m_build. this is rare enough to
+                // not bother doing in parallel
+                const int axis = job.centroidBounds.longest_axis();
+                std::nth_element(&m_prims[job.first], &m_prims[job.mid], &m_prims[job.first] + job.count,
+                    [&](const BuildPrim &a, const BuildPrim &b) { return a.centroid[axis] < b.centroid[axis]; });
+            }
+        }
+
+        // partition: count each chunk's left side, turn that into where each
+        // chunk writes its spheres, then scatter them into m_primsTmp
+        auto goesLeft = [&](const BuildJob &job, uint32_t i) {
+            if (job.axis < 0) return i < job.mid;
+            return m_goesLeft(m_prims[i].centroid, job.centroidBounds, job.axis, job.split);
+        };
+        pool.parallel_for(chunks.size(), [&](uint32_t c) {
+            BuildChunk &chunk = chunks[c];
+            chunk.numLeft = 0;
+            for (uint32_t i = chunk.start; i < chunk.end; i++)
+                chunk.numLeft += goesLeft(level[chunk.job], i);
+        });
+        for (uint32_t j = 0, c = 0; j < level.size(); j++)
+        {
+            uint32_t left = level[j].first, right;
+            for (uint32_t k = c; k < chunks.size() && chunks[k].job == j; k++)
+                left += chunks[k].numLeft;
+            level[j].mid = right = left;
+            left = level[j].first;
+            for (; c < chunks.size() && chunks[c].job == j; c++)
+            {
+                chunks[c].leftOffset = left;
+                chunks[c].rightOffset = right;
+                left += chunks[c].numLeft;
+                right += (chunks[c].end - chunks[c].start) - chunks[c].numLeft;
+            }
+        }
+        pool.parallel_for(chunks.size(), [&](uint32_t c) {
+            BuildChunk &chunk = chunks[c];
+            uint32_t out[2] = { chunk.leftOffset, chunk.rightOffset };
+            for (uint32_t i = chunk.start; i < chunk.end; i++)
+            {
+                const BuildPrim &p = m_prims[i];
+                const int side = goesLeft(level[chunk.job], i)? 0 : 1;
+                m_primsTmp[out[side]++] = p;
+                chunk.childBounds[side].grow(p.bounds);
+                chunk.childCentroids[side].grow(p.centroid);
+            }
+        });
+        pool.parallel_for(chunks.size(), [&](uint32_t c) {
+            std::copy(&m_primsTmp[chunks[c].start], &m_primsTmp[chunks[c].end], &m_prims[chunks[c].start]);
+        });
+
+        // make the children. big ones get split on the next level, the rest
+        // are built as subtrees
+        std::vector<BuildJob> next;
+        for (uint32_t j = 0, c = 0; j < level.size(); j++)
+        {
+            const BuildJob &job = level[j];
+            BuildJob child[2] {};
+            for (; c < chunks.size() && chunks[c].job == j; c++)
+                for (int side = 0; side < 2; side++)
+                    child[side].centroidBounds.grow(chunks[c].childCentroids[side]);
+
+            const uint32_t left = m_nodes.size();
+            m_nodes.push_back(BVHNode());
+            m_nodes.push_back(BVHNode());
+            m_nodes[job.node].leftOrFirst = left;
+            m_nodes[job.node].count = 0;
+            child[0].first = job.first;
+            child[0].count = job.mid - job.first;
+            child[1].first = job.mid;
+            child[1].count = job.first + job.count - job.mid;
+            for (int side = 0; side < 2; side++)
+            {
+                child[side].node = left + side;
+                child[side].depth = job.depth + 1;
+                if (child[side].count > subtreeSize) next.push_back(child[side]);
+                else subtrees.push_back(child[side]);
+            }
+        }
+        level.swap(next);
+    }
+
+    // biggest subtrees first, so a big one isn't left running on its own at
+    // the end
+    std::sort(subtrees.begin(), subtrees.end(),
+              [](const BuildJob &a, const BuildJob &b) { return a.count > b.count; });
+    std::vector<std::vector<BVHNode>> subtreeNodes(subtrees.size());
+    pool.parallel_for(subtrees.size(), [&](uint32_t s) {
+        std::vector<BVHNode> &nodes = subtreeNodes[s];
+        nodes.reserve(2*subtrees[s].count - 1);
+        nodes.push_back(BVHNode());
+        m_build(nodes, 0, subtrees[s].first, subtrees[s].count, subtrees[s].depth);
+    });
+
+    // stitch them in: each subtree's root goes in the slot its parent already
+    // points at, and the rest of its nodes are appended as a block
+    std::vector<uint32_t> base(subtrees.size());
+    uint32_t total = m_nodes.size();
+    for (uint32_t s = 0; s < subtrees.size(); s++)
+    {
+        base[s] = total;
+        total += subtreeNodes[s].size() - 1;
+    }
+    m_nodes.resize(total);
+    pool.parallel_for(subtrees.size(), [&](uint32_t s) {
+        const std::vector<BVHNode> &nodes = subtreeNodes[s];
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            BVHNode node = nodes[i];
+            // local index k>0 ends up at base+k-1
+            if (!node.isLeaf()) node.leftOrFirst += base[s] - 1;
+            m_nodes[i == 0 ? subtrees[s].node : base[s] + i - 1] = node;
+        }
+        subtreeNodes[s] = std::vector<BVHNode>();
+    });
+}
+
+bool BVH::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    const vec3 origin = rayIn.origin();
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+
+    float tEntry;
+    if (!slab_test(m_nodes[0].bmin, m_nodes[0].bmax, origin, invDir, tMin, tMax, tEntry))
+        return false;
+
+    // nodes still to visit, along with where the ray enters them; once
+    // something closer has been hit, those can be skipped when popped
+    struct entry { uint32_t node; float t; };
+    entry stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, tEntry };
+
+    bool hitAnything = false;
+    float closest = tMax;
+    uint32_t closestIndex = 0;
+    while (stackSize > 0)
+    {
+        const entry e = stack[--stackSize];
+        if (e.t >= closest) continue;
+        const BVHNode &node = m_nodes[e.node];
+
+        if (node.isLeaf())
+        {
+            const int i = m_leaves.closest(rayIn, node.leftOrFirst, node.count, tMin, closest, closest);
+            if (i >= 0)
+            {
+                hitAnything = true;
+                closestIndex = i;
+            }
+            continue;
+        }
+
+        // visit the nearer child first, so closest shrinks as fast as it can
+        // and more of the far side gets skipped. so: push far, then near.
+        const uint32_t l = node.leftOrFirst, r = l + 1;
+        float tl, tr;
+        const bool hl = slab_test(m_nodes[l].bmin, m_nodes[l].bmax, origin, invDir, tMin, closest, tl);
+        const bool hr = slab_test(m_nodes[r].bmin, m_nodes[r].bmax, origin, invDir, tMin, closest, tr);
+        if (hl && hr)
+        {
+            if (tl <= tr) { stack[stackSize++] = { r, tr }; stack[stackSize++] = { l, tl }; }
+            else          { stack[stackSize++] = { l, tl }; stack[stackSize++] = { r, tr }; }
+        }
+        else if (hl) stack[stackSize++] = { l, tl };
+        else if (hr) stack[stackSize++] = { r, tr };
+    }
+    if (hitAnything) info = { closest, closestIndex, this };
+    return hitAnything;
+}
+
+void BVH::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    m_leaves.fill(rayIn, info.prim, info.t, rec);
+}
+
+// intersect(), but done at the first hit. tMax never shrinks, so there's
+// nothing to be gained from visiting the nearer child first, or from keeping
+// entry distances on the stack.
+bool BVH::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    const vec3 origin = rayIn.origin();
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+
+    float tEntry;
+    if (!slab_test(m_nodes[0].bmin, m_nodes[0].bmax, origin, invDir, tMin, tMax, tEntry))
+        return false;
+
+    uint32_t stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const BVHNode &node = m_nodes[stack[--stackSize]];
+        if (node.isLeaf())
+        {
+            if (m_leaves.any(rayIn, node.leftOrFirst, node.count, tMin, tMax)) return true;
+            continue;
+        }
+        const uint32_t l = node.leftOrFirst, r = l + 1;
+        if (slab_test(m_nodes[l].bmin, m_nodes[l].bmax, origin, invDir, tMin, tMax, tEntry)) stack[stackSize++] = l;
+        if (slab_test(m_nodes[r].bmin, m_nodes[r].bmax, origin, invDir, tMin, tMax, tEntry)) stack[stackSize++] = r;
+    }
+    return false;
+}
+
+#endif
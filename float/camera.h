@@ -2,7 +2,8 @@
 #define CAMERAH
 
 #include "vector.h"
-#include "ray.h"
+#include "../ray.h"
+#include "ray_packet.h"
 
 class Camera
 {
@@ -11,6 +12,8 @@ public:
 
     ray getRay(float u, float v)
     { return ray(world_origin, camera_origin + u*horizontal + v*vertical - world_origin); }
+    // getRay() for a whole packet; u and v have one entry per ray
+    void getRays(const float *u, const float *v, RayPacket &packet);
 
     vec3 world_origin;
     vec3 camera_origin;
@@ -32,4 +35,10 @@ Camera::Camera(vec3 lookfrom, vec3 lookat, vec3 up, float vfov, float aspect)
     vertical = 2 * half_height * v;
 }
 
+void Camera::getRays(const float *u, const float *v, RayPacket &packet)
+{
+    for (int i = 0; i < PACKET_SIZE; i++)
+        packet.set(i, getRay(u[i], v[i]));
+}
+
 #endif
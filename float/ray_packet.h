@@ -0,0 +1,47 @@
+#ifndef RAYPACKETH
+#define RAYPACKETH
+
+#include <cfloat>
+
+#include "vector.h"
+#include "../ray.h"
+
+// A bundle of PACKET_WIDTH x PACKET_HEIGHT camera rays for neighbouring
+// pixels, traced together. They start at the same point and go in nearly the
+// same direction, so they go through the same boxes and hit the same spheres.
+// The SIMD version tests them against those four at a time; here, everything
+// traces a packet one ray after another (see Hitable::intersect_packet), so it's
+// only the interface.
+//
+// Everything is stored one array per component.
+
+#define PACKET_SIZE (PACKET_WIDTH * PACKET_HEIGHT)
+
+struct RayPacket
+{
+    float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    float tMax[PACKET_SIZE];   // closest hit so far
+
+    inline void set(int i, const ray &r);
+    // ray i is left out: nothing can hit it
+    inline void disable(int i);
+    inline ray get(int i) const { return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i])); }
+    inline bool active(int i) const { return tMax[i] >= 0; }
+};
+
+inline void RayPacket::set(int i, const ray &r)
+{
+    const vec3 o = r.origin(), d = r.direction();
+    ox[i] = o.x(); oy[i] = o.y(); oz[i] = o.z();
+    dx[i] = d.x(); dy[i] = d.y(); dz[i] = d.z();
+    tMax[i] = FLT_MAX;
+}
+
+inline void RayPacket::disable(int i)
+{
+    set(i, ray(vec3(0,0,0), vec3(1,1,1)));
+    tMax[i] = -FLT_MAX;
+}
+
+#endif
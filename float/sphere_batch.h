@@ -0,0 +1,178 @@
+#ifndef SPHEREBATCHH
+#define SPHEREBATCHH
+
+#include <vector>
+#include <cfloat>
+
+#include "vector.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "sphere.h"
+
+// A whole pile of spheres behind one Hitable. Instead of a list of pointers
+// to separate Sphere objects (and a virtual call for each), the centers and
+// radii are kept in contiguous arrays, one per component, and intersect()
+// runs a single tight loop over all of them, tracking only the closest t and
+// which sphere it was.
+//
+// The spheres can also be kept in groups and tested a group at a time with
+// closest() and any(). That's what the BVHs do with their leaves: one leaf
+// is one group, so a leaf is a single run through the arrays.
+
+// spheres per pass. there's no vector unit in this tree, so groups don't
+// need to line up with anything
+#define SPHERE_BATCH_WIDTH 1
+
+class SphereBatch : public Hitable
+{
+public:
+    SphereBatch() {}
+    SphereBatch(Sphere **list, int n) { for (int i = 0; i < n; i++) add(*list[i]); }
+
+    void add(const vec3 &center, float radius, uint32_t matId);
+    void add(const Sphere &s) { add(s.center, s.radius, s.matId); }
+    // room for a group of count spheres, to be filled in with set(). returns
+    // the group's first slot.
+    uint32_t addGroup(uint32_t count);
+    void set(uint32_t slot, const Sphere &s);
+    int size() const { return m_count; }
+
+    vec3 center(uint32_t slot) const { return vec3(m_cx[slot], m_cy[slot], m_cz[slot]); }
+    float radiusSq(uint32_t slot) const { return m_radiusSq[slot]; }
+
+    // the closest hit in (tMin,tMax) among the count slots from first.
+    // returns its slot and puts its distance in t, or returns -1 (leaving t
+    // alone) if there's nothing there.
+    inline int closest(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &t) const;
+    // whether any of them is hit in (tMin,tMax)
+    inline bool any(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax) const;
+    // the hit_record for slot's sphere hit at t
+    inline void fill(const ray &rayIn, uint32_t slot, float t, hit_record &rec) const;
+
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+
+private:
+    int m_count = 0;
+    std::vector<float> m_cx, m_cy, m_cz;
+    std::vector<float> m_radius, m_radiusSq;
+    std::vector<uint32_t> m_matIds;
+};
+
+void SphereBatch::add(const vec3 &center, float radius, uint32_t matId)
+{
+    set(addGroup(1), Sphere(center, radius, matId));
+}
+
+uint32_t SphereBatch::addGroup(uint32_t count)
+{
+    const uint32_t first = m_count;
+    m_count += count;
+    m_cx.resize(m_count); m_cy.resize(m_count); m_cz.resize(m_count);
+    m_radius.resize(m_count); m_radiusSq.resize(m_count);
+    m_matIds.resize(m_count);
+    return first;
+}
+
+void SphereBatch::set(uint32_t slot, const Sphere &s)
+{
+    m_cx[slot] = s.center.x();
+    m_cy[slot] = s.center.y();
+    m_cz[slot] = s.center.z();
+    m_radius[slot] = s.radius;
+    m_radiusSq[slot] = s.radius*s.radius;
+    m_matIds[slot] = s.matId;
+}
+
+inline int SphereBatch::closest(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &t) const
+{
+    const vec3 o = rayIn.origin();
+    const vec3 d = rayIn.direction();
+    const float a = d.squared_length();
+    const float inv_a = 1.0f / a;
+
+    float closest = tMax;
+    int closestIndex = -1;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        // same quadratic as Sphere::closest_t
+        const float ocx = o.x() - m_cx[i];
+        const float ocy = o.y() - m_cy[i];
+        const float ocz = o.z() - m_cz[i];
+        const float b = ocx*d.x() + ocy*d.y() + ocz*d.z();
+        const float c = ocx*ocx + ocy*ocy + ocz*ocz - m_radiusSq[i];
+        const float discrim = b*b - a*c;
+        if (discrim > 0)
+        {
+            const float sq = sqrt(discrim);
+            // try "minus" root, then "plus" root
+            float tHit = (-b - sq) * inv_a;
+            if (!(tHit < closest && tHit > tMin)) tHit = (-b + sq) * inv_a;
+            if (tHit < closest && tHit > tMin)
+            {
+                closest = tHit;
+                closestIndex = i;
+            }
+        }
+    }
+    if (closestIndex >= 0) t = closest;
+    return closestIndex;
+}
+
+// same loop as closest(), stopping at the first hit
+inline bool SphereBatch::any(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax) const
+{
+    const vec3 o = rayIn.origin();
+    const vec3 d = rayIn.direction();
+    const float a = d.squared_length();
+    const float inv_a = 1.0f / a;
+
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        const float ocx = o.x() - m_cx[i];
+        const float ocy = o.y() - m_cy[i];
+        const float ocz = o.z() - m_cz[i];
+        const float b = ocx*d.x() + ocy*d.y() + ocz*d.z();
+        const float c = ocx*ocx + ocy*ocy + ocz*ocz - m_radiusSq[i];
+        const float discrim = b*b - a*c;
+        if (discrim > 0)
+        {
+            const float sq = sqrt(discrim);
+            float t = (-b - sq) * inv_a;
+            if (!(t < tMax && t > tMin)) t = (-b + sq) * inv_a;
+            if (t < tMax && t > tMin) return true;
+        }
+    }
+    return false;
+}
+
+inline void SphereBatch::fill(const ray &rayIn, uint32_t slot, float t, hit_record &rec) const
+{
+    rec.t = t;
+    rec.p = rayIn.point_at_parameter(t);
+    rec.normal = (rec.p - center(slot)) / m_radius[slot];
+    rec.matId = m_matIds[slot];
+}
+
+bool SphereBatch::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    float t;
+    const int i = closest(rayIn, 0, m_count, tMin, tMax, t);
+    if (i < 0) return false;
+    info = { t, uint32_t(i), this };
+    return true;
+}
+
+bool SphereBatch::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    return any(rayIn, 0, m_count, tMin, tMax);
+}
+
+void SphereBatch::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    fill(rayIn, info.prim, info.t, rec);
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <iostream>
 
+#include "../sampler.h"
+
 class vec3
 {
 public:
@@ -213,17 +215,67 @@ inline vec3 cross(const vec3& v1, const vec3& v2)
 
 inline vec3 normalize(vec3 v) { return v / v.length(); }
 
-inline vec3 random_in_unit_sphere()
+// u and v (and w) in [0,1) to directions, with no rejection loop: throwing
+// numbers away would leave the sampler's later ones out of step, and costs
+// a branch that goes either way about half the time.
+
+// on the unit sphere: the height is uniform, and so is the angle around
+inline vec3 uniform_sphere(float u, float v)
+{
+    const float z = 2.0f * u - 1.0f;
+    const float phi = 2.0f * float(M_PI) * v;
+    const float r = sqrt(fmaxf(0.0f, 1.0f - z*z));
+    return vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+// in the unit sphere: a direction, then how far out, with the cube root
+// giving each shell its share by volume
+inline vec3 uniform_ball(float u, float v, float w)
+{
+    return cbrtf(w) * uniform_sphere(u, v);
+}
+
+// cosine-weighted about the normal, which is what a Lambertian surface
+// reflects: the normal plus a point on the unit sphere. the one point that
+// cancels the normal out gives back the normal instead.
+inline vec3 cosine_hemisphere(const vec3 &normal, float u, float v)
+{
+    const vec3 dir = normal + uniform_sphere(u, v);
+    return (dir.squared_length() < 1e-8f)? normal : dir;
+}
+
+// the same, with the numbers from a sampler. u and v are taken as a pair, so
+// the sampler can spread them out over the sphere evenly.
+inline vec3 random_unit_vector(Sampler &sampler)
+{
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return uniform_sphere(u, v);
+}
+
+inline vec3 random_in_unit_sphere(Sampler &sampler)
+{
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return uniform_ball(u, v, sampler.next_float());
+}
+
+inline vec3 random_cosine_direction(const vec3 &normal, Sampler &sampler)
 {
-    vec3 p;
-    do {
-        // pick random point in unit cube
-        p = 2.0f*vec3(drand48(),drand48(),drand48()) - vec3(1,1,1);
-    // reject while not in unit sphere
-    } while (p.squared_length() >= 1);
-    return p;
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return cosine_hemisphere(normal, u, v);
 }
 
 inline vec3 reflect(const vec3& v, const vec3& n) { return v - 2.0f*dot(v,n)*n; }
 
+// a finished pixel's color, 0..1, as the 0..255.99 that writePixel() (in
+// ../thread_pool.h) cuts down to bytes. SDL assumes the image is gamma-
+// corrected, and it isn't, so each channel is raised to the power of
+// 1/gamma; to simplify this math, gamma=2 is used.
+inline vec3 to_display(const vec3 &col)
+{
+    return vec3(sqrt(col[0]) * 255.99f, sqrt(col[1]) * 255.99f, sqrt(col[2]) * 255.99f);
+}
+
 #endif
@@ -0,0 +1,324 @@
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+
+#include <cfloat>
+#include <vector>
+
+#include "vector.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "camera.h"
+#include "material.h"
+#include "sphere.h"
+#include "../pixel_stats.h"
+#include "../lights.h"
+
+// The wavefront integrator. ThreadPool::color() follows one path all the way
+// to the end before starting the next (a "megakernel"): intersect, scatter
+// off whatever it hit, intersect again... so back to back scatter() calls
+// switch to different materials, and neither the branch predictor nor the
+// instruction cache ever settles down.
+//
+// Here every sample in a tile is in flight at once, and they all take their
+// bounces in lockstep:
+//   1. intersect -- find the closest hit for every path still going
+//   2. sort      -- paths that hit nothing are done; the rest are queued up
+//                   by the kind of material they hit
+//   3. shade     -- each queue goes through its own kind's scatter_*() in
+//                   one tight loop, with no switch. diffuse hits also pick a
+//                   point on a light, and queue up a shadow ray for it
+//   4. shadows   -- the shadow rays are traced, all together, and the light
+//                   from the ones that get through is added on
+//   5. compact   -- finished paths are dropped, and the rest are packed to
+//                   the front for the next bounce
+//
+// Path state is kept one array per field. Each path has its own Rng and does
+// exactly the sums it would in color(), so the image comes out the same as
+// the megakernel's.
+
+// the signature of the scatter_*() functions in material.h
+typedef bool (*ScatterFn)(const Material &, ray &, const hit_record &, vec3 &, bool &, Sampler &);
+
+class Wavefront
+{
+public:
+    // traces numSamples more samples for each pixel in [x0,x1) x [y0,y1)
+    // that's set in pActive (the tile's mask, TILE_WIDTH to a row), and adds
+    // them onto that pixel's entry in pAccumBuffer (the whole image's, which
+    // is imageWidth x imageHeight). no path takes more than maxBounces bounces.
+    // returns how many rays that took, not counting shadow rays. pLights is
+    // null for no next event estimation.
+    uint64_t render(Hitable *pWorld, const MaterialTable *pMaterials, Camera *pCam, int imageWidth, int imageHeight,
+                    int x0, int y0, int x1, int y1, const uint8_t *pActive,
+                    uint32_t numSamples, SamplerKind samplerKind, PixelStats *pAccumBuffer,
+                    bool russianRoulette, int maxBounces, const LightList *pLights);
+
+private:
+    void m_generate(Camera *pCam, int x0, int y0, int x1, int y1, const uint8_t *pActive,
+                    uint32_t numSamples, SamplerKind samplerKind, const PixelStats *pAccumBuffer);
+    void m_intersect(Hitable *pWorld, bool cameraRays);
+    void m_sort();
+    template<ScatterFn SCATTER> void m_shade(MaterialKind kind);
+    void m_traceShadows(Hitable *pWorld);
+    void m_compact();
+
+    const MaterialTable *m_pMaterials;
+    int m_imageWidth, m_imageHeight;
+    const LightList *m_pLights;
+    bool m_russianRoulette;
+    int m_bounce;                        // the one every path is on
+
+    // the paths still going; entry i of every array belongs to path i
+    uint32_t m_numPaths = 0;
+    std::vector<vec3> m_origin, m_direction;
+    std::vector<vec3> m_throughput;      // attenuations so far, multiplied up
+    std::vector<vec3> m_radiance;        // light found so far
+    std::vector<float> m_bsdfPdf;        // of the last bounce, if it was a diffuse one
+    std::vector<Sampler> m_sampler;
+    std::vector<uint32_t> m_sample;      // which entry of m_result is this path's
+    std::vector<uint8_t> m_hit, m_alive;
+    std::vector<hit_record> m_rec;
+
+    std::vector<uint32_t> m_queues[NUM_MATERIAL_KINDS];   // paths, by what they hit
+
+    // this bounce's shadow rays, and the light each one brings if it gets
+    // through (already multiplied by its path's throughput)
+    std::vector<ray> m_shadowRays;
+    std::vector<float> m_shadowTMax;
+    std::vector<vec3> m_shadowLight;
+    std::vector<uint32_t> m_shadowPath;
+    std::vector<vec3> m_result;          // every sample's color, (sample, pixel) order
+};
+
+uint64_t Wavefront::render(Hitable *pWorld, const MaterialTable *pMaterials, Camera *pCam, int imageWidth, int imageHeight,
+                           int x0, int y0, int x1, int y1, const uint8_t *pActive,
+                           uint32_t numSamples, SamplerKind samplerKind, PixelStats *pAccumBuffer,
+                           bool russianRoulette, int maxBounces, const LightList *pLights)
+{
+    m_pMaterials = pMaterials;
+    m_imageWidth = imageWidth;
+    m_imageHeight = imageHeight;
+    m_russianRoulette = russianRoulette;
+    m_pLights = (pLights && pLights->size() > 0)? pLights : nullptr;
+    const int width = x1 - x0;
+    const uint32_t numPixels = width * (y1 - y0);
+    const uint32_t numPaths = numPixels * numSamples;
+    // only ever grows, so after the first tile there's no more allocating
+    if (m_origin.size() < numPaths)
+    {
+        m_origin.resize(numPaths); m_direction.resize(numPaths);
+        m_throughput.resize(numPaths); m_sampler.resize(numPaths);
+        m_radiance.resize(numPaths); m_bsdfPdf.resize(numPaths);
+        m_sample.resize(numPaths); m_hit.resize(numPaths);
+        m_alive.resize(numPaths); m_rec.resize(numPaths);
+        m_result.resize(numPaths);
+        for (std::vector<uint32_t> &queue : m_queues) queue.reserve(numPaths);
+        m_shadowRays.reserve(numPaths); m_shadowTMax.reserve(numPaths);
+        m_shadowLight.reserve(numPaths); m_shadowPath.reserve(numPaths);
+    }
+
+    m_generate(pCam, x0, y0, x1, y1, pActive, numSamples, samplerKind, pAccumBuffer);
+    uint64_t numRays = 0;
+    for (m_bounce = 0; m_bounce < maxBounces && m_numPaths > 0; m_bounce++)
+    {
+        numRays += m_numPaths;
+        m_intersect(pWorld, m_bounce == 0);
+        m_sort();
+        m_shade<scatter_diffuse>(MaterialKind::Diffuse);
+        m_shade<scatter_metal>(MaterialKind::Metal);
+        m_shade<scatter_emmissive>(MaterialKind::Emmissive);
+        m_shade<scatter_glass>(MaterialKind::Glass);
+        m_shade<scatter_translucent>(MaterialKind::Translucent);
+        m_shade<scatter_normals>(MaterialKind::Normals);
+        m_traceShadows(pWorld);
+        m_compact();
+    }
+    // anything still going ran out of bounces, and keeps what it has
+    for (uint32_t i = 0; i < m_numPaths; i++)
+        m_result[m_sample[i]] = m_radiance[i];
+
+    // same clamping, and the same order of adding up, as doRayTrace
+    for (uint32_t p = 0; p < numPixels; p++)
+    {
+        const int x = x0 + p % width, y = y0 + p / width;
+        if (!pActive[(y - y0)*TILE_WIDTH + (x - x0)]) continue;
+        PixelStats pixel = pAccumBuffer[y*m_imageWidth + x];
+        for (uint32_t s = 0; s < numSamples; s++)
+            pixel.add(m_result[s*numPixels + p].clamp(0.0f, 1.0f));
+        pAccumBuffer[y*m_imageWidth + x] = pixel;
+    }
+    return numRays;
+}
+
+// camera rays for every sample of the active pixels, with the same random
+// numbers doRayTrace would use. they go sample by sample, and row by row
+// within that, so neighbouring paths start out going the same way. a path's
+// result goes in m_result at (sample, pixel), whether or not every pixel is
+// active, so the sums at the end can find it.
+void Wavefront::m_generate(Camera *pCam, int x0, int y0, int x1, int y1, const uint8_t *pActive,
+                           uint32_t numSamples, SamplerKind samplerKind, const PixelStats *pAccumBuffer)
+{
+    const uint32_t numPixels = (x1 - x0) * (y1 - y0);
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < numSamples; s++)
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+            {
+                if (!pActive[(y - y0)*TILE_WIDTH + (x - x0)]) continue;
+                const uint32_t pixel = (y - y0)*(x1 - x0) + (x - x0);
+                Sampler sampler(samplerKind, x, y, pAccumBuffer[y*m_imageWidth + x].numSamples + s);
+                float du = 0, dv = 0;
+                sampler.next_2d(du, dv);
+                float u = float(x + du) * (1.0f / m_imageWidth);
+                float v = float(y + dv) * (1.0f / m_imageHeight);
+                const ray r = pCam->getRay(u, v);
+                m_origin[n] = r.origin();
+                m_direction[n] = r.direction();
+                m_throughput[n] = vec3(1,1,1);
+                m_radiance[n] = vec3(0,0,0);
+                m_bsdfPdf[n] = 0;
+                m_sampler[n] = sampler;
+                m_sample[n] = s*numPixels + pixel;
+                m_result[m_sample[n]] = vec3(0,0,0);
+                n++;
+            }
+    m_numPaths = n;
+}
+
+// the camera rays are still coherent, so with USE_PACKETS they're handed
+// over a packet at a time; the bounces aren't, so they go one by one
+void Wavefront::m_intersect(Hitable *pWorld, bool cameraRays)
+{
+#if USE_PACKETS == true
+    if (cameraRays)
+    {
+        RayPacket packet;
+        hit_record recs[PACKET_SIZE];
+        for (uint32_t first = 0; first < m_numPaths; first += PACKET_SIZE)
+        {
+            for (int j = 0; j < PACKET_SIZE; j++)
+            {
+                if (first + j < m_numPaths) packet.set(j, ray(m_origin[first + j], m_direction[first + j]));
+                else packet.disable(j);
+            }
+            pWorld->hit_packet(packet, 0.0001f, recs);
+            for (int j = 0; j < PACKET_SIZE && first + j < m_numPaths; j++)
+            {
+                m_hit[first + j] = packet.tMax[j] < FLT_MAX;
+                m_rec[first + j] = recs[j];
+            }
+        }
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < m_numPaths; i++)
+        m_hit[i] = pWorld->hit(ray(m_origin[i], m_direction[i]), 0.0001f, FLT_MAX, m_rec[i]);
+}
+
+void Wavefront::m_sort()
+{
+    for (std::vector<uint32_t> &queue : m_queues) queue.clear();
+    m_shadowRays.clear(); m_shadowTMax.clear();
+    m_shadowLight.clear(); m_shadowPath.clear();
+    for (uint32_t i = 0; i < m_numPaths; i++)
+    {
+        if (m_hit[i])
+        {
+            m_queues[int((*m_pMaterials)[m_rec[i].matId].kind)].push_back(i);
+            m_alive[i] = 1;
+        }
+        else
+        {
+            m_radiance[i] += m_throughput[i] * SKYBOX_COLOR;
+            m_alive[i] = 0;
+        }
+    }
+}
+
+// everything in the queue hit the same kind of material, so its scatter_*()
+// is known up front and gets inlined into the loop. the light sampling,
+// pdfs and weights are all the same as in color().
+template<ScatterFn SCATTER>
+void Wavefront::m_shade(MaterialKind kind)
+{
+    const bool nee = m_pLights && kind == MaterialKind::Diffuse;
+    for (uint32_t i : m_queues[int(kind)])
+    {
+        const Material &m = (*m_pMaterials)[m_rec[i].matId];
+        m_sampler[i].startBounce(m_bounce);
+        if (nee)
+        {
+            ray shadowRay;
+            float tMax;
+            vec3 light;
+            if (m_pLights->sample(m_rec[i], m.albedo, m_sampler[i], shadowRay, tMax, light))
+            {
+                m_shadowRays.push_back(shadowRay);
+                m_shadowTMax.push_back(tMax);
+                m_shadowLight.push_back(m_throughput[i] * light);
+                m_shadowPath.push_back(i);
+            }
+        }
+        ray r(m_origin[i], m_direction[i]);
+        vec3 attenuation;
+        bool isLightSource = false;
+        if (SCATTER(m, r, m_rec[i], attenuation, isLightSource, m_sampler[i]))
+        {
+            m_throughput[i] *= attenuation;
+            m_origin[i] = r.origin();
+            m_direction[i] = r.direction();
+            m_bsdfPdf[i] = nee? diffuse_pdf(r.direction(), m_rec[i].normal) : 0;
+            // same place in the path, and the same random number, as color()
+            if (m_russianRoulette && m_bounce + 1 >= RUSSIAN_ROULETTE_DEPTH &&
+                !survives_roulette(m_throughput[i], m_sampler[i]))
+                m_alive[i] = 0;
+        }
+        else
+        {
+            if (isLightSource)
+            {
+                const float weight = (m_pLights && m_bsdfPdf[i] > 0 && kind == MaterialKind::Emmissive)?
+                    power_heuristic(m_bsdfPdf[i], m_pLights->pdf(m_origin[i], m_rec[i])) : 1.0f;
+                m_radiance[i] += m_throughput[i] * attenuation * weight;
+            }
+            m_alive[i] = 0;
+        }
+    }
+}
+
+void Wavefront::m_traceShadows(Hitable *pWorld)
+{
+    for (uint32_t k = 0; k < m_shadowRays.size(); k++)
+        if (!pWorld->occluded(m_shadowRays[k], 0.0001f, m_shadowTMax[k]))
+            m_radiance[m_shadowPath[k]] += m_shadowLight[k];
+}
+
+// finished paths hand in what they found; the ones still going are packed
+// to the front, keeping their order
+void Wavefront::m_compact()
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < m_numPaths; i++)
+    {
+        if (!m_alive[i])
+        {
+            m_result[m_sample[i]] = m_radiance[i];
+            continue;
+        }
+        if (n != i)
+        {
+            m_origin[n] = m_origin[i];
+            m_direction[n] = m_direction[i];
+            m_throughput[n] = m_throughput[i];
+            m_radiance[n] = m_radiance[i];
+            m_bsdfPdf[n] = m_bsdfPdf[i];
+            m_sampler[n] = m_sampler[i];
+            m_sample[n] = m_sample[i];
+        }
+        n++;
+    }
+    m_numPaths = n;
+}
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef WIDEBVHH
+#define WIDEBVHH
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+#include "vector.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "aabb.h"
+#include "bvh.h"
+
+// A BVH with W (4 or 8) children per node instead of 2, made by collapsing a
+// binary BVH: each wide node starts from a binary node's two children and
+// keeps opening up the biggest interior one until it has W. The children's
+// boxes are stored one array per component (the SIMD version tests them all
+// in a single pass; here it's a plain loop). Leaves aren't nodes of their
+// own; a child slot just points straight at its leaf's group of spheres in
+// the SphereBatch.
+//
+// Compared to the binary BVH, that's fewer trips around the traversal loop
+// and far fewer box tests done one at a time.
+
+// each level down can add up to W-1 entries, and the binary tree is at most
+// BVH_MAX_SAH_DEPTH plus a few dozen median splits deep
+#define WIDE_BVH_STACK_SIZE 1024
+
+template <int W>
+struct alignas(64) WideBVHNode
+{
+    float bminX[W], bminY[W], bminZ[W];
+    float bmaxX[W], bmaxY[W], bmaxZ[W];
+    uint32_t child[W];   // interior child: index of its node; leaf child: first sphere
+    uint32_t count[W];   // number of spheres for a leaf child; 0 for interior
+
+    // every slot starts out empty, with a box sitting out at infinity. the
+    // slab test can never pass that, whatever direction the ray goes.
+    WideBVHNode()
+    {
+        for (int i = 0; i < W; i++)
+        {
+            bminX[i] = bminY[i] = bminZ[i] = INFINITY;
+            bmaxX[i] = bmaxY[i] = bmaxZ[i] = INFINITY;
+            child[i] = count[i] = 0;
+        }
+    }
+};
+
+// the ray's origin and 1/direction, as used for every node
+template <int W>
+struct wide_ray
+{
+    wide_ray(const vec3 &origin, const vec3 &invDir) : o(origin), inv(invDir) {}
+    vec3 o, inv;
+};
+
+// slab test for all of a node's children, one at a time, same as
+// slab_test() in aabb.h. returns a bitmask of the boxes the ray goes through
+// inside [tMin,tMax], and writes their entry distances to tNear.
+template <int W>
+inline int wide_slab_test(const WideBVHNode<W> &node, const wide_ray<W> &r,
+                          float tMin, float tMax, float *tNear)
+{
+    const float *bmin[3] = { node.bminX, node.bminY, node.bminZ };
+    const float *bmax[3] = { node.bmaxX, node.bmaxY, node.bmaxZ };
+    int mask = 0;
+    for (int i = 0; i < W; i++)
+    {
+        float tn = tMin, tf = tMax;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (bmin[axis][i] - r.o[axis]) * r.inv[axis];
+            float t1 = (bmax[axis][i] - r.o[axis]) * r.inv[axis];
+            if (t0 > t1) { float tmp = t0; t0 = t1; t1 = tmp; }
+            tn = (t0 > tn)? t0 : tn;
+            tf = (t1 < tf)? t1 : tf;
+        }
+        tNear[i] = tn;
+        mask |= (tn <= tf) << i;
+    }
+    return mask;
+}
+
+template <int W>
+class WideBVH : public Hitable
+{
+public:
+    WideBVH() {}
+    WideBVH(Sphere **list, int n, ThreadPool *pPool = nullptr);
+
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+
+    uint32_t numNodes() const { return m_nodes.size(); }
+    uint32_t numSpheres() const { return m_leaves.size(); }
+
+private:
+    uint32_t m_collapse(const std::vector<BVHNode> &binary, uint32_t node);
+
+    std::vector<WideBVHNode<W>> m_nodes;
+    SphereBatch m_leaves;    // the binary BVH's, one group per leaf; leaf slots index into this
+};
+
+
+template <int W>
+WideBVH<W>::WideBVH(Sphere **list, int n, ThreadPool *pPool)
+{
+    BVH binary(list, n, pPool);
+    m_leaves = binary.leaves();
+    m_nodes.reserve(binary.numNodes() / 2 + 1);
+    if (n > 0) m_collapse(binary.nodes(), 0);
+    else m_nodes.push_back(WideBVHNode<W>());
+}
+
+// makes a wide node out of the binary subtree under node, and returns its
+// index
+template <int W>
+uint32_t WideBVH<W>::m_collapse(const std::vector<BVHNode> &binary, uint32_t node)
+{
+    // start from the node's two children, then keep replacing the interior
+    // one with the biggest surface area (the one a ray is likeliest to go
+    // into) by its own two children, until there are W of them
+    uint32_t kids[W];
+    int numKids = 0;
+    if (binary[node].isLeaf()) kids[numKids++] = node;   // only for a root that's a leaf
+    else
+    {
+        kids[numKids++] = binary[node].leftOrFirst;
+        kids[numKids++] = binary[node].leftOrFirst + 1;
+    }
+    while (numKids < W)
+    {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < numKids; i++)
+        {
+            const BVHNode &k = binary[kids[i]];
+            if (k.isLeaf()) continue;
+            const float area = aabb(vec3(k.bmin[0], k.bmin[1], k.bmin[2]),
+                                    vec3(k.bmax[0], k.bmax[1], k.bmax[2])).surface_area();
+            if (area > bestArea) { bestArea = area; best = i; }
+        }
+        if (best < 0) break;
+        const uint32_t left = binary[kids[best]].leftOrFirst;
+        kids[best] = left;
+        kids[numKids++] = left + 1;
+    }
+
+    const uint32_t index = m_nodes.size();
+    m_nodes.push_back(WideBVHNode<W>());
+    for (int i = 0; i < numKids; i++)
+    {
+        const BVHNode &k = binary[kids[i]];
+        WideBVHNode<W> &wide = m_nodes[index];
+        wide.bminX[i] = k.bmin[0]; wide.bminY[i] = k.bmin[1]; wide.bminZ[i] = k.bmin[2];
+        wide.bmaxX[i] = k.bmax[0]; wide.bmaxY[i] = k.bmax[1]; wide.bmaxZ[i] = k.bmax[2];
+        wide.child[i] = k.leftOrFirst;
+        wide.count[i] = k.count;
+    }
+    // m_nodes grows while collapsing the children, so no holding on to a
+    // reference across these
+    for (int i = 0; i < numKids; i++)
+        if (!binary[kids[i]].isLeaf())
+        {
+            const uint32_t c = m_collapse(binary, kids[i]);
+            m_nodes[index].child[i] = c;
+        }
+    return index;
+}
+
+template <int W>
+bool WideBVH<W>::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    const wide_ray<W> r(rayIn.origin(), invDir);
+
+    // nodes still to visit, along with where the ray enters them; once
+    // something closer has been hit, those can be skipped when popped
+    struct entry { uint32_t node; float t; };
+    entry stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hitAnything = false;
+    float closest = tMax;
+    uint32_t closestIndex = 0;
+    uint32_t current = 0;
+    while (true)
+    {
+        const WideBVHNode<W> &node = m_nodes[current];
+        alignas(32) float tNear[W];
+        int mask = wide_slab_test(node, r, tMin, closest, tNear);
+
+        // leaves get tested on the spot. the child nodes that were hit are
+        // sorted far to near, so the nearest one can be gone into next and
+        // the rest pushed for later.
+        entry hits[W];
+        int numHits = 0;
+        while (mask)
+        {
+            const int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] > 0)
+            {
+                const int s = m_leaves.closest(rayIn, node.child[i], node.count[i], tMin, closest, closest);
+                if (s >= 0)
+                {
+                    hitAnything = true;
+                    closestIndex = s;
+                }
+                continue;
+            }
+            int j = numHits++;
+            for (; j > 0 && hits[j-1].t < tNear[i]; j--) hits[j] = hits[j-1];
+            hits[j] = { node.child[i], tNear[i] };
+        }
+
+        if (numHits > 0 && hits[numHits-1].t < closest)
+        {
+            for (int i = 0; i < numHits - 1; i++) stack[stackSize++] = hits[i];
+            current = hits[numHits-1].node;
+            continue;
+        }
+
+        // nothing (or nothing nearer than what's been hit) down here, so
+        // back up to the next node on the stack that's still worth a look
+        do
+        {
+            if (stackSize == 0)
+            {
+                if (hitAnything) info = { closest, closestIndex, this };
+                return hitAnything;
+            }
+            current = stack[--stackSize].node;
+        } while (stack[stackSize].t >= closest);
+    }
+}
+
+template <int W>
+void WideBVH<W>::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    m_leaves.fill(rayIn, info.prim, info.t, rec);
+}
+
+// like BVH::occluded: stops at the first hit, and the children are visited
+// in whatever order they come, since there's no closest hit to shrink
+template <int W>
+bool WideBVH<W>::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    const wide_ray<W> r(rayIn.origin(), invDir);
+
+    uint32_t stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const WideBVHNode<W> &node = m_nodes[stack[--stackSize]];
+        alignas(32) float tNear[W];
+        int mask = wide_slab_test(node, r, tMin, tMax, tNear);
+        while (mask)
+        {
+            const int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0)
+            {
+                stack[stackSize++] = node.child[i];
+                continue;
+            }
+            if (m_leaves.any(rayIn, node.child[i], node.count[i], tMin, tMax)) return true;
+        }
+    }
+    return false;
+}
+
+#endif
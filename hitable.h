@@ -0,0 +1,84 @@
+#ifndef HITABLEH
+#define HITABLEH
+
+#include "ray.h"
+
+// abstract class for hitable targets. shared by both trees; each one
+// includes it after its own vector.h and ray_packet.h.
+
+struct hit_record
+{
+    float t;
+    vec3 p;
+    vec3 normal;
+    uint32_t matId;   // index into the MaterialTable
+};
+
+class Hitable;
+
+// a hit as it's tracked while searching for the closest one: just how far
+// along the ray it is, and which primitive of which object it was (prim is
+// numbered however pObj likes). working out the point, normal and material
+// is left to pObj->resolve() once the search is over, so it's done once
+// per ray rather than for every hit that a closer one then replaces.
+struct hit_info
+{
+    float t;
+    uint32_t prim;
+    const Hitable *pObj;
+};
+
+class Hitable
+{
+public:
+    virtual ~Hitable() {}
+
+    // finds the closest hit in (tMin,tMax) and puts it in info. info is left
+    // alone if there's nothing there.
+    virtual bool intersect(const ray &pRayIn, float tMin, float tMax, hit_info &info) const = 0;
+
+    // fills in the hit_record for a hit this object found (one whose
+    // hit_info has pObj == this). does nothing by default
+    virtual void resolve(const ray &, const hit_info &, hit_record &) const {}
+
+    // is there anything at all in (tMin,tMax)? for shadow rays, which only
+    // need a yes or no: it can stop at the first hit it comes across, and
+    // never touches a hit_record. this default just looks for the closest.
+    virtual bool occluded(const ray &pRayIn, float tMin, float tMax) const
+    {
+        hit_info info;
+        return intersect(pRayIn, tMin, tMax, info);
+    }
+
+    // intersect(), then resolve() for the winner
+    bool hit(const ray &pRayIn, float tMin, float tMax, hit_record &pRec) const
+    {
+        hit_info info;
+        if (!intersect(pRayIn, tMin, tMax, info)) return false;
+        info.pObj->resolve(pRayIn, info, pRec);
+        return true;
+    }
+
+    // intersect() for a whole packet of rays. each ray's closest hit so far
+    // is in packet.tMax; wherever something closer turns up, that gets moved
+    // in and the ray's entry in pInfos is filled in. this default just
+    // traces them one at a time.
+    virtual void intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const
+    {
+        for (int i = 0; i < PACKET_SIZE; i++)
+            if (packet.active(i) && intersect(packet.get(i), tMin, packet.tMax[i], pInfos[i]))
+                packet.tMax[i] = pInfos[i].t;
+    }
+
+    // intersect_packet(), then resolve() for each ray that hit something
+    void hit_packet(RayPacket &packet, float tMin, hit_record *pRecs) const
+    {
+        hit_info infos[PACKET_SIZE];
+        for (int i = 0; i < PACKET_SIZE; i++) infos[i].pObj = nullptr;
+        intersect_packet(packet, tMin, infos);
+        for (int i = 0; i < PACKET_SIZE; i++)
+            if (infos[i].pObj) infos[i].pObj->resolve(packet.get(i), infos[i], pRecs[i]);
+    }
+};
+
+#endif
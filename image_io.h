@@ -0,0 +1,259 @@
+#ifndef IMAGEIOH
+#define IMAGEIOH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+// Writes finished images to disk without going through SDL, for rendering
+// with no window (and no display) at all.
+//
+//   .ppm -- binary PPM (P6), 8 bits a channel
+//   .png -- 8 bits a channel. there's no zlib here, so the pixels go in
+//           "stored" deflate blocks, uncompressed: bigger files, but any
+//           PNG reader takes them
+//   .exr -- OpenEXR, 32-bit float RGB, uncompressed scanlines
+//
+// The 8-bit ones are what the window shows (ThreadPool::resolve()'s RGBA8
+// buffer, gamma 2). EXR keeps the pixels' averages as they are, in linear
+// light (ThreadPool::resolveLinear()).
+
+// one of resolve()'s pixels back into its channels; the packing is
+// writePixel()'s, which depends on the byte order
+inline void unpack_rgba(uint32_t pixel, uint8_t &r, uint8_t &g, uint8_t &b)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    r = pixel >> 24; g = pixel >> 16; b = pixel >> 8;
+#elif __BYTE_ORDER == __BIG_ENDIAN
+    r = pixel; g = pixel >> 8; b = pixel >> 16;
+#else
+# error "Please fix <bits/endian.h>"
+#endif
+}
+
+// little-endian and big-endian numbers onto the end of a byte buffer
+inline void put_le32(std::vector<uint8_t> &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) out.push_back(uint8_t(v >> (8*i)));
+}
+
+inline void put_le64(std::vector<uint8_t> &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) out.push_back(uint8_t(v >> (8*i)));
+}
+
+inline void put_be32(std::vector<uint8_t> &out, uint32_t v)
+{
+    for (int i = 3; i >= 0; i--) out.push_back(uint8_t(v >> (8*i)));
+}
+
+inline void put_string(std::vector<uint8_t> &out, const char *s)
+{
+    out.insert(out.end(), s, s + strlen(s) + 1);
+}
+
+inline bool write_file(const char *pFileName, const std::vector<uint8_t> &bytes)
+{
+    FILE *f = fopen(pFileName, "wb");
+    if (!f) return false;
+    const bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return (fclose(f) == 0) && ok;
+}
+
+inline bool write_ppm(const char *pFileName, const uint32_t *pPixels, int width, int height)
+{
+    char header[64];
+    const int headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> bytes(header, header + headerSize);
+    bytes.reserve(headerSize + size_t(width) * height * 3);
+    for (size_t i = 0; i < size_t(width) * height; i++)
+    {
+        uint8_t r, g, b;
+        unpack_rgba(pPixels[i], r, g, b);
+        bytes.push_back(r); bytes.push_back(g); bytes.push_back(b);
+    }
+    return write_file(pFileName, bytes);
+}
+
+inline uint32_t crc32(const uint8_t *pData, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1)? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        tableReady = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// a PNG chunk: length, type, data, and the CRC of the type and data
+inline void put_png_chunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data)
+{
+    put_be32(out, data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_be32(out, crc32(out.data() + start, out.size() - start));
+}
+
+inline bool write_png(const char *pFileName, const uint32_t *pPixels, int width, int height)
+{
+    // every row starts with its filter type, 0 for none
+    std::vector<uint8_t> raw;
+    raw.reserve(size_t(width * 3 + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        for (int x = 0; x < width; x++)
+        {
+            uint8_t r, g, b;
+            unpack_rgba(pPixels[size_t(y) * width + x], r, g, b);
+            raw.push_back(r); raw.push_back(g); raw.push_back(b);
+        }
+    }
+
+    // a zlib stream of stored blocks, up to 65535 bytes each, and the
+    // Adler-32 of what's in them
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i++)
+    {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    size_t pos = 0;
+    do
+    {
+        const uint32_t len = (raw.size() - pos < 65535)? raw.size() - pos : 65535;
+        zlib.push_back(pos + len == raw.size());    // the last block?
+        zlib.push_back(len & 0xFF); zlib.push_back(len >> 8);
+        zlib.push_back(~len & 0xFF); zlib.push_back((~len >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+    put_be32(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    header.push_back(8);    // bits per channel
+    header.push_back(2);    // RGB
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // not interlaced
+
+    std::vector<uint8_t> bytes = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    bytes.reserve(zlib.size() + 64);
+    put_png_chunk(bytes, "IHDR", header);
+    put_png_chunk(bytes, "IDAT", zlib);
+    put_png_chunk(bytes, "IEND", std::vector<uint8_t>());
+    return write_file(pFileName, bytes);
+}
+
+// an EXR header attribute: name, type, size, value
+inline void put_exr_attribute(std::vector<uint8_t> &out, const char *name, const char *type, const std::vector<uint8_t> &value)
+{
+    put_string(out, name);
+    put_string(out, type);
+    put_le32(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// pRGB is width x height pixels of three floats each
+inline bool write_exr(const char *pFileName, const float *pRGB, int width, int height)
+{
+    std::vector<uint8_t> bytes;
+    put_le32(bytes, 20000630);    // magic number
+    put_le32(bytes, 2);           // version 2, single-part scanlines
+
+    // the channels have to be listed in alphabetical order, and the pixels
+    // are stored the same way
+    std::vector<uint8_t> channels;
+    for (const char *name : { "B", "G", "R" })
+    {
+        put_string(channels, name);
+        put_le32(channels, 2);    // FLOAT
+        put_le32(channels, 0);    // pLinear, and three reserved bytes
+        put_le32(channels, 1);    // x sampling
+        put_le32(channels, 1);    // y sampling
+    }
+    channels.push_back(0);
+    std::vector<uint8_t> window;
+    put_le32(window, 0); put_le32(window, 0);
+    put_le32(window, width - 1); put_le32(window, height - 1);
+    std::vector<uint8_t> one, zero2;
+    const float fOne = 1.0f, fZero = 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &fOne, 4); put_le32(one, bits);
+    memcpy(&bits, &fZero, 4); put_le32(zero2, bits); put_le32(zero2, bits);
+
+    put_exr_attribute(bytes, "channels", "chlist", channels);
+    put_exr_attribute(bytes, "compression", "compression", { 0 });    // none
+    put_exr_attribute(bytes, "dataWindow", "box2i", window);
+    put_exr_attribute(bytes, "displayWindow", "box2i", window);
+    put_exr_attribute(bytes, "lineOrder", "lineOrder", { 0 });        // increasing y
+    put_exr_attribute(bytes, "pixelAspectRatio", "float", one);
+    put_exr_attribute(bytes, "screenWindowCenter", "v2f", zero2);
+    put_exr_attribute(bytes, "screenWindowWidth", "float", one);
+    bytes.push_back(0);
+
+    // where each scanline starts, then the scanlines: y, byte count, and
+    // each channel's row in turn
+    const uint32_t lineSize = uint32_t(width) * 3 * 4;
+    const uint64_t tableEnd = bytes.size() + uint64_t(height) * 8;
+    for (int y = 0; y < height; y++)
+        put_le64(bytes, tableEnd + uint64_t(y) * (8 + lineSize));
+    bytes.reserve(tableEnd + uint64_t(height) * (8 + lineSize));
+    for (int y = 0; y < height; y++)
+    {
+        put_le32(bytes, y);
+        put_le32(bytes, lineSize);
+        for (int c = 2; c >= 0; c--)
+            for (int x = 0; x < width; x++)
+            {
+                memcpy(&bits, &pRGB[(size_t(y) * width + x) * 3 + c], 4);
+                put_le32(bytes, bits);
+            }
+    }
+    return write_file(pFileName, bytes);
+}
+
+// picks the format from pFileName's extension. pRGB is only needed for EXR,
+// and pPixels only for the others. returns false if the extension isn't one
+// of them, or the file can't be written.
+inline bool save_image(const char *pFileName, const uint32_t *pPixels, const float *pRGB, int width, int height)
+{
+    const char *ext = strrchr(pFileName, '.');
+    if (!ext) return false;
+    if (strcasecmp(ext, ".ppm") == 0) return write_ppm(pFileName, pPixels, width, height);
+    if (strcasecmp(ext, ".png") == 0) return write_png(pFileName, pPixels, width, height);
+    if (strcasecmp(ext, ".exr") == 0) return write_exr(pFileName, pRGB, width, height);
+    return false;
+}
+
+// whether save_image() knows the extension
+inline bool is_image_format(const char *pFileName)
+{
+    const char *ext = strrchr(pFileName, '.');
+    return ext && (strcasecmp(ext, ".ppm") == 0 || strcasecmp(ext, ".png") == 0 || strcasecmp(ext, ".exr") == 0);
+}
+
+// whether it's EXR, which needs the linear pixels
+inline bool is_exr(const char *pFileName)
+{
+    const char *ext = strrchr(pFileName, '.');
+    return ext && strcasecmp(ext, ".exr") == 0;
+}
+
+#endif
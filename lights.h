@@ -0,0 +1,164 @@
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include <cmath>
+#include <vector>
+
+#include "ray.h"
+#include "hitable.h"
+// (the tree's sphere.h and material.h come first)
+
+// The scene's lights, for next event estimation: at every diffuse hit a
+// point on one of the lights is picked, and a shadow ray checks whether
+// it's in view, instead of waiting for a bounce to run into a light by
+// chance. For small lights that chance is tiny, and the image stays speckled
+// for a very long time.
+//
+// Bounces still find the lights too. Both ways of getting there count, each
+// weighted by how likely it was to be the one that found the light (multiple
+// importance sampling, with the power heuristic). A small light is easy to
+// aim at and hard to hit by chance, so nearly all of its light comes from
+// the shadow rays. A big, close light is the reverse.
+//
+// Only Emmissive spheres that end the path (no continueTracing) are
+// lights; the others tint whatever is behind them instead of giving off
+// light of their own.
+
+struct Light
+{
+    vec3 center;
+    float radius;
+    vec3 emission;
+    uint32_t matId;
+};
+
+inline float power_heuristic(float pdf, float otherPdf)
+{
+    return (pdf*pdf) / (pdf*pdf + otherPdf*otherPdf);
+}
+
+// how likely a diffuse bounce is to go in direction dir: scatter_diffuse
+// picks directions with a cosine falloff from the normal
+inline float diffuse_pdf(const vec3 &dir, const vec3 &normal)
+{
+    const float cosine = dot(normalize(dir), normal);
+    return (cosine > 0)? cosine / float(M_PI) : 0;
+}
+
+class LightList
+{
+public:
+    LightList() {}
+    // every light needs a material of its own, for pdf() to find it by;
+    // light spheres that share one get copies of it added to materials
+    LightList(Sphere **ppSpheres, uint32_t count, MaterialTable &materials);
+
+    uint32_t size() const { return m_lights.size(); }
+    const Light &operator[](uint32_t i) const { return m_lights[i]; }
+
+    inline bool sample(const hit_record &rec, const vec3 &albedo, Sampler &sampler,
+                       ray &shadowRay, float &tMax, vec3 &light) const;
+    inline float pdf(const vec3 &from, const hit_record &rec) const;
+
+private:
+    // the solid angle a light takes up, seen from a point outside it, is
+    // 2 pi (1 - cos(theta_max)). 1 - cos is worked out from sin^2 so that it
+    // doesn't come out as 0 for far away lights.
+    static inline float m_coneOneMinusCos(const Light &l, float distSq);
+
+    std::vector<Light> m_lights;
+    // which light each material belongs to, by matId; NO_LIGHT for the
+    // ones that aren't a light's
+    std::vector<uint32_t> m_lightOfMaterial;
+};
+
+#define NO_LIGHT 0xFFFFFFFFu
+
+LightList::LightList(Sphere **ppSpheres, uint32_t count, MaterialTable &materials)
+{
+    m_lightOfMaterial.assign(materials.size(), NO_LIGHT);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Material m = materials[ppSpheres[i]->matId];
+        if (m.kind != MaterialKind::Emmissive || m.continueTracing) continue;
+        if (m_lightOfMaterial[ppSpheres[i]->matId] != NO_LIGHT)
+        {
+            ppSpheres[i]->matId = materials.add(m);
+            m_lightOfMaterial.push_back(NO_LIGHT);
+        }
+        m_lightOfMaterial[ppSpheres[i]->matId] = m_lights.size();
+        m_lights.push_back({ ppSpheres[i]->center, ppSpheres[i]->radius, m.albedo * m.strength, ppSpheres[i]->matId });
+    }
+}
+
+inline float LightList::m_coneOneMinusCos(const Light &l, float distSq)
+{
+    const float sinSq = l.radius*l.radius / distSq;
+    return sinSq / (1.0f + sqrt(1.0f - sinSq));
+}
+
+// picks a light, and a direction towards it from the diffuse hit rec, evenly
+// over the cone the light fills. shadowRay goes that way, and needs to reach
+// tMax without hitting anything for the light to count. light is what then
+// arrives: emission, times the surface's albedo/pi and cosine, over the pdf,
+// times the MIS weight. returns false if there's nothing to check (the light
+// is behind the surface, or the hit is inside it).
+//
+// it always takes three random numbers, whatever happens, so the rest of the
+// path's random numbers don't depend on it.
+inline bool LightList::sample(const hit_record &rec, const vec3 &albedo, Sampler &sampler,
+                              ray &shadowRay, float &tMax, vec3 &light) const
+{
+    if (m_lights.empty()) return false;
+    const uint32_t n = m_lights.size();
+    uint32_t pick = uint32_t(sampler.next_float() * n);
+    if (pick >= n) pick = n - 1;
+    float u1 = 0, u2 = 0;
+    sampler.next_2d(u1, u2);
+
+    const Light &l = m_lights[pick];
+    const vec3 toCenter = l.center - rec.p;
+    const float distSq = toCenter.squared_length();
+    if (distSq <= l.radius*l.radius) return false;
+    const float dist = sqrt(distSq);
+
+    // a direction in the cone, around w
+    const vec3 w = toCenter / dist;
+    const vec3 a = (fabsf(w[0]) > 0.9f)? vec3(0,1,0) : vec3(1,0,0);
+    const vec3 u = normalize(cross(a, w));
+    const vec3 v = cross(w, u);
+    const float oneMinusCos = m_coneOneMinusCos(l, distSq);
+    const float cosTheta = 1.0f - u1 * oneMinusCos;
+    const float sinTheta = sqrt(fmaxf(0.0f, 1.0f - cosTheta*cosTheta));
+    const float phi = 2.0f * float(M_PI) * u2;
+    const vec3 dir = (cosf(phi) * sinTheta) * u + (sinf(phi) * sinTheta) * v + cosTheta * w;
+
+    const float cosSurface = dot(dir, rec.normal);
+    if (cosSurface <= 0) return false;
+
+    // where it meets the light: the nearer root of |p + t dir - c| = r. the
+    // shadow ray stops just short of it, so the light doesn't block itself.
+    const float b = dot(toCenter, dir);
+    const float t = b - sqrt(fmaxf(0.0f, b*b - (distSq - l.radius*l.radius)));
+    shadowRay = ray(rec.p, dir);
+    tMax = t * 0.999f;
+
+    const float lightPdf = 1.0f / (2.0f * float(M_PI) * oneMinusCos * n);
+    const float bsdfPdf = cosSurface / float(M_PI);
+    light = l.emission * albedo * (cosSurface / float(M_PI) / lightPdf * power_heuristic(lightPdf, bsdfPdf));
+    return true;
+}
+
+// the pdf sample() would have had of picking the direction from `from` to
+// the light hit at rec, for weighting a bounce that ran into it. 0 if rec
+// isn't on one of the lights. the hit's material says which light it is.
+inline float LightList::pdf(const vec3 &from, const hit_record &rec) const
+{
+    if (rec.matId >= m_lightOfMaterial.size() || m_lightOfMaterial[rec.matId] == NO_LIGHT) return 0;
+    const Light &l = m_lights[m_lightOfMaterial[rec.matId]];
+    const float distSq = (l.center - from).squared_length();
+    if (distSq <= l.radius*l.radius) return 0;
+    return 1.0f / (2.0f * float(M_PI) * m_coneOneMinusCos(l, distSq) * m_lights.size());
+}
+
+#endif
@@ -4,9 +4,26 @@
 #define WINDOW_WIDTH 1280
 #define WINDOW_HEIGHT 720
 #define NUM_ALIAS_STEPS 8
+#define PROGRESSIVE true
+#define ADAPTIVE true
+#define ADAPTIVE_THRESHOLD 0.004f
+#define ADAPTIVE_MIN_SAMPLES 4
+#define ADAPTIVE_MAX_SAMPLES 64
 #define MAX_NUM_REFLECTIONS 64
+#define RUSSIAN_ROULETTE true
+#define RUSSIAN_ROULETTE_DEPTH 3
+#define NEXT_EVENT_ESTIMATION true
+#define SAMPLER SamplerKind::Sobol
 #define SKYBOX_COLOR vec3(0.1,0.1,0.1)
+#define NUM_EXTRA_SPHERES 0
 #define NUM_THREADS 1
-#define USE_SIMD false
+#define TILE_WIDTH 32
+#define TILE_HEIGHT 32
+#define SCHEDULING Scheduling::WorkStealing
+#define INTEGRATOR Integrator::Megakernel
+#define USE_PACKETS true
+#define PACKET_WIDTH 8
+#define PACKET_HEIGHT 8
+#define BACKEND Backend::Auto
 
 #endif
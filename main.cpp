@@ -1,100 +1,16 @@
 #include <time.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
 #include <SDL2/SDL.h>
 
 #include "macros.h"
+#include "settings.h"
+#include "renderer.h"
+#include "dispatch.h"
 #include "screen.h"
-
-#if USE_SIMD == true
-    #include "simd/vector.h"
-    #include "simd/ray.h"
-    #include "simd/camera.h"
-    #include "simd/hitable.h"
-    #include "simd/hitable_list.h"
-    #include "simd/sphere.h"
-    #include "simd/material.h"
-    #include "simd/thread_pool.h"
-#else
-    #include "float/vector.h"
-    #include "float/ray.h"
-    #include "float/camera.h"
-    #include "float/hitable.h"
-    #include "float/hitable_list.h"
-    #include "float/sphere.h"
-    #include "float/material.h"
-    #include "float/thread_pool.h"
-#endif
-
-// inline vec3 process_float(vec3 v1, vec3 v2) {
-//     const __m128 XMM_POS_2_loc = _mm_set1_ps(2.0);
-//     const __m128 XMM_NEG_1_loc = _mm_set1_ps(-1.0);
-//     __m128 r;
-//     vec3 p;
-//     do {
-//         // pick random point in unit cube
-//         r = _mm_set_ps(drand48(), drand48(), drand48(), 0);
-//         p = vec3(_mm_fmadd_ps(r, XMM_POS_2_loc, XMM_NEG_1_loc));  // 2x-1 ; scales [0,1] to [-1,1]
-//     // reject while not in unit sphere; this happens when : sqrt(x^2 + y^2 + z^2) > 1
-//     } while (p.squared_length() > 1);
-//     return p;
-// }
-//
-// static const __m128 XMM_POS_2 = _mm_set1_ps(2.0);
-// static const __m128 XMM_NEG_1 = _mm_set1_ps(-1.0);
-//
-// inline vec3 process_simd(vec3 v1, vec3 v2) {
-//     __m128 r;
-//     vec3 p;
-//     do {
-//         // pick random point in unit cube
-//         r = _mm_set_ps(drand48(), drand48(), drand48(), 0);
-//         p = vec3(_mm_fmadd_ps(r, XMM_POS_2, XMM_NEG_1));  // 2x-1 ; scales [0,1] to [-1,1]
-//     // reject while not in unit sphere; this happens when : sqrt(x^2 + y^2 + z^2) > 1
-//     } while (p.squared_length() > 1);
-//     return p;
-// }
-//
-// int _main()
-// {
-//     clock_t init, start_float, stop_float, start_simd, stop_simd;
-//
-//     long n = 10;//INT16_MAX;
-//     vec3 vecs_a[n];
-//     vec3 vecs_b[n];
-//     vec3 out_float[n];
-//     vec3 out_simd[n];
-//
-//     init = clock();
-//     for (long i = 0; i < n; i++)
-//     {
-//         vecs_a[i] = vec3(0,0,0);//random_in_unit_sphere();
-//         vecs_b[i] = vec3(0,0,0);//random_in_unit_sphere();
-//     }
-//
-//     start_float = clock();
-//     for (long i = 0; i < n; i++)
-//     {
-//         out_float[i] = process_float(vecs_a[i], vecs_b[i]);
-//     }
-//     stop_float = clock();
-//
-//     start_simd = clock();
-//     for (long i = 0; i < n; i++)
-//     {
-//         out_simd[i] = process_simd(vecs_a[i], vecs_b[i]);
-//     }
-//     stop_simd = clock();
-//
-//     // std::cout << "use_simd=" << USE_SIMD << std::endl;
-//     // std::cout << "n=" << n << std::endl;
-//
-//     // double init_seconds = ((double)(start_float - init)) / CLOCKS_PER_SEC;
-//     double float_seconds = ((double)(stop_float - start_float)) / CLOCKS_PER_SEC;
-//     double simd_seconds = ((double)(stop_simd - start_simd)) / CLOCKS_PER_SEC;
-//     std::cout << "locals took:  " << float_seconds << std::endl;
-//     std::cout << "global took:   " << simd_seconds << std::endl;
-//
-//     return 0;
-// }
+#include "image_io.h"
 
 // gross but functional
 // displays output i.e.    23% done   [||||___________]
@@ -114,95 +30,183 @@ float displ_progress(int done, int total, int width)
 }
 
 
-int main()
+// see parse_settings() in settings.h for the arguments
+int main(int argc, char **argv)
 {
-    clock_t setup_start, render_start, render_stop;
-    setup_start = clock();
-
-#if USE_SIMD == true
-    std::cout << "Using SIMD vectors" << std::endl;
-#else
-    std::cout << "Using standard float vectors" << std::endl;
-#endif
-
-    int num_pixels = WINDOW_WIDTH * WINDOW_HEIGHT;
-
-    Hitable *dList[9];
-    dList[0] = new Sphere(vec3( 0,   100.6, -2  ), 100, new Diffuse(   vec3(0.3, 0.5, 0.7)                ));
-    dList[1] = new Sphere(vec3( 0,     0,   -2  ), 0.5, new Diffuse(   vec3(0.8, 0.3, 0.3)                ));
-    dList[2] = new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, new Metal(     vec3(0.7, 0.7, 0.7),   0.4         ));
-    dList[3] = new Sphere(vec3( 1,     0,   -2  ), 0.4, new Metal(     vec3(0.3, 0.4, 0.9),   0.05        ));
-    dList[4] = new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, new Glass(     vec3(0.5, 1.0, 0.6),   0.9         ));
-    dList[5] = new Sphere(vec3( 0,     0.2,  1  ), 0.3, new Glass(     vec3(0.8, 0.2, 0.3),   0.0         ));
-    dList[6] = new Sphere(vec3(-1,    -0.3, -1.2), 0.2, new Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false ));
-    dList[7] = new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, new Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false ));
-    dList[8] = new Sphere(vec3( 0,    -5.0, -3  ), 2.0, new Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false ));
-    Hitable *pWorld = new HitableList(dList, 9);
-
-    // Hitable *dList[1];
-    // dList[0] = new Sphere(vec3(0, 0, -2), 0.5, new Diffuse(vec3(0.8, 0.3, 0.3)));
-    // Hitable *pWorld = new HitableList(dList, 1);
-
-    Camera cam(
-            vec3(-1,0,2),
-            vec3(0,0,-1),
-            vec3(0,1,0),
-            70,
-            (float)WINDOW_WIDTH/WINDOW_HEIGHT
-        );
-
-    ThreadPool pool(NUM_THREADS);
+    clock_t render_start, render_stop;
+    std::chrono::steady_clock::time_point render_wall_start;
+    auto setup_start = std::chrono::steady_clock::now();
+
+    RenderSettings settings;
+    if (!parse_settings(argc, argv, settings)) return 1;
+    const char *output = settings.output;
+    const int width = settings.width, height = settings.height;
+    int exitCode = 0;
+    if (output && !is_image_format(output))
+    {
+        fprintf(stderr, "Can't save '%s' (try .png, .ppm or .exr).\n", output);
+        return 1;
+    }
+
+    Renderer *pRenderer = make_renderer(settings);
+    if (!pRenderer) return 1;
+    std::cout << "Using " << pRenderer->name()
+              << ((settings.backend == Backend::Auto)? " (the best this CPU has)" : " (forced)") << std::endl;
+
+    int num_pixels = width * height;
     uint32_t *pFrameBuffer = new uint32_t[num_pixels];
-    threadInfo globalInfo {
-        pWorld,
-        &cam,
-        pFrameBuffer
-    };
-    pool.init(&globalInfo);
+    pRenderer->setup(pFrameBuffer);
 
+    // with --headless there's no Screen, and SDL is never started. the
+    // image only goes to the file at the end.
     SDL_Event e;
-    Screen screen(WINDOW_WIDTH, WINDOW_HEIGHT, 1);
-    free(screen.pTextureBuffer);
-    screen.pTextureBuffer = pFrameBuffer;
-    //screen.show(); // first draw -- black screen
-
-    render_start = clock();
-    pool.start();
-    printf("ThreadPool started. Using %d threads.\n", pool.getNumThreads());
+    Screen *pScreen = nullptr;
+    if (!settings.headless)
+    {
+        pScreen = new Screen(width, height, 1);
+        delete[] pScreen->pTextureBuffer;
+        pScreen->pTextureBuffer = pFrameBuffer;
+        //pScreen->show(); // first draw -- black screen
+    }
 
-    int i = 0;
-    int x = 0;
-    int y = 0;
+    // with PROGRESSIVE, the image is traced a pass at a time, one sample per
+    // pixel each, and shown after every pass; it starts out noisy and cleans
+    // up as the passes add up. otherwise each pass is every sample at once.
+    // space pauses after the current pass (and carries on again from where
+    // it left off), for when it's good enough.
+    //
+    // the budget is settings.samples samples a pixel, on average. with
+    // ADAPTIVE, pixels drop out of the passes once they're smooth, and what
+    // they don't use goes to the noisy ones; it can also finish early, if
+    // every pixel is done before the budget is. h flips the window between
+    // the image and a heatmap of how many samples each pixel got.
+    const uint32_t samplesPerPass = PROGRESSIVE? 1 : settings.samples;
+    const uint64_t budget = uint64_t(settings.samples) * num_pixels;
+    pRenderer->setSamples(samplesPerPass);
+    pRenderer->setAdaptive(ADAPTIVE);
+    pRenderer->clear();
+    printf("Using %d threads, %s integrator, %s sampling, %dx%d, up to %d bounces.\n", pRenderer->getNumThreads(),
+           integrator_name(settings.integrator), ADAPTIVE? "adaptive" : "uniform", width, height, settings.maxBounces);
+
+    bool paused = false, heatmap = false;
+    auto display = [&]() {
+        if (heatmap) pRenderer->resolveHeatmap();
+        else pRenderer->resolve();
+        pScreen->show();
+    };
+    auto handleKey = [&](const SDL_Event &ev) {
+        if (ev.type != SDL_KEYDOWN) return;
+        if (ev.key.keysym.sym == SDLK_SPACE) paused = !paused;
+        if (ev.key.keysym.sym == SDLK_h) { heatmap = !heatmap; if (!pRenderer->running()) display(); }
+    };
 
-    while (true)
+    // the BVH build is timed on its own, on the wall clock, since clock()
+    // adds up every thread's time
+    double setup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - setup_start).count()
+                         - pRenderer->buildSeconds();
+    render_start = clock();
+    render_wall_start = std::chrono::steady_clock::now();
+    uint64_t spent = 0, lastPass = uint64_t(samplesPerPass) * num_pixels, rays = 0;
+    uint32_t pass = 0;
+    while (spent < budget)
     {
-        //screen.show();
-        if (pool.running() && pool.shouldTerminate)
+        pRenderer->start();
+
+        // sleep until a tile finishes rather than spinning; the timeout is
+        // only there so the window keeps handling events on very slow tiles.
+        // how far into the pass it is gets guessed from how big the last
+        // one was.
+        uint32_t done = 0;
+        while (done < pRenderer->numTiles())
         {
-            screen.show();
-            render_stop = clock();
-            pool.stop();
-
-            double setup_seconds =  ((double)(render_start - setup_start)) / CLOCKS_PER_SEC;
-            double render_seconds = ((double)(render_stop - render_start)) / CLOCKS_PER_SEC;
-            printf("Render complete.\n");
-            printf("Setup took:  %.3f seconds.\n", setup_seconds);
-            printf("Render took: %.3f seconds.\n", render_seconds);
-            printf("Render took: %.3f scaled seconds.\n", render_seconds/NUM_THREADS);
+            done = pRenderer->waitForProgress(done, 50);
+            uint64_t guess = spent + lastPass * done / pRenderer->numTiles();
+            displ_progress((guess < budget)? guess : budget, budget, 40);
+            fflush(stdout);
+            while (pScreen && SDL_PollEvent(&e))
+            {
+                if (e.type == SDL_QUIT) goto quit;
+                handleKey(e);
+            }
         }
-        while (SDL_PollEvent(&e))
+        pRenderer->stop();
+        lastPass = pRenderer->samplesTraced();
+        if (lastPass == 0) break;   // every pixel is done
+        spent += lastPass;
+        rays += pRenderer->raysTraced();
+        pass++;
+        if (!pScreen) continue;
+
+        display();
+        char title[96];
+        snprintf(title, sizeof(title), "pass %u, %.2f samples/pixel%s%s", pass, double(spent) / num_pixels,
+                 heatmap? " (heatmap)" : "", (paused && spent < budget)? " (paused)" : "");
+        pScreen->setTitle(title);
+
+        while (paused && spent < budget && SDL_WaitEvent(&e))
+        {
             if (e.type == SDL_QUIT) goto quit;
-        SDL_Delay(10);
+            handleKey(e);
+        }
+    }
+    displ_progress(1, 1, 40);
+    printf("\n");
+    render_stop = clock();
+    {
+        double render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_wall_start).count();
+        double cpu_seconds = ((double)(render_stop - render_start)) / CLOCKS_PER_SEC;
+        printf("Render complete.\n");
+        printf("Setup took:  %.3f seconds.\n", setup_seconds);
+        printf("BVH build took: %.3f seconds (%s, %u spheres, %u nodes, %s scene).\n",
+               pRenderer->buildSeconds(), accel_name(settings.accel), pRenderer->numSpheres(), pRenderer->numNodes(),
+               scene_name(settings.scene));
+        printf("Render took: %.3f seconds (%.3f seconds of CPU time, over %d threads).\n",
+               render_seconds, cpu_seconds, pRenderer->getNumThreads());
+        printf("Rendered %.3f Msamples/s, %.3f Mrays/s.\n", spent / render_seconds / 1e6, rays / render_seconds / 1e6);
+        printf("Average path length: %.3f rays (russian roulette %s).\n",
+               double(rays) / spent, RUSSIAN_ROULETTE? "on" : "off");
+        printf("Traced %llu samples in %u passes (%.2f per pixel, %.0f%% of the budget).\n",
+               (unsigned long long)spent, pass, double(spent) / num_pixels, 100.0 * spent / budget);
+    }
+
+    // the image, not the heatmap, even if that's what the window shows
+    if (output)
+    {
+        std::vector<float> linear;
+        pRenderer->resolve();
+        if (is_exr(output))
+        {
+            linear.resize(size_t(num_pixels) * 3);
+            pRenderer->resolveLinear(linear.data());
+        }
+        if (!save_image(output, pFrameBuffer, linear.data(), width, height))
+        {
+            fprintf(stderr, "Couldn't write '%s'.\n", output);
+            exitCode = 1;
+        }
+        else printf("Saved %s.\n", output);
+        if (pScreen && heatmap) pRenderer->resolveHeatmap();
+    }
+
+    // nothing left to do but keep the window up; block until it's closed
+    while (pScreen && SDL_WaitEvent(&e))
+    {
+        if (e.type == SDL_QUIT) break;
+        handleKey(e);
     }
 
 quit:
-    if (pool.running()) pool.stop();
-    screen.show();
-    free(pWorld);
-    free(pFrameBuffer);
-    screen.quit(false);
-    SDL_Quit();
-    exit(0);
+    if (pRenderer->running()) pRenderer->stop();
+    delete pRenderer;
+    if (pScreen)
+    {
+        pScreen->show();
+        pScreen->quit(false);
+        delete pScreen;
+        SDL_Quit();
+    }
+    delete[] pFrameBuffer;
+    exit(exitCode);
 
 
     return 0;
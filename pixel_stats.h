@@ -0,0 +1,51 @@
+#ifndef PIXELSTATSH
+#define PIXELSTATSH
+
+#include <cfloat>
+#include <cmath>
+// (after the tree's vector.h)
+
+// What the accumulation buffer keeps for each pixel: its samples added up
+// (each one clamped to 0..1 first), how many there were, and the sum of
+// their luminances squared. The last one is what tells how noisy the pixel
+// still is, for adaptive sampling.
+
+inline float luminance(const vec3 &c)
+{
+    return 0.2126f*c[0] + 0.7152f*c[1] + 0.0722f*c[2];
+}
+
+struct PixelStats
+{
+    vec3 sum;
+    float lumSq;
+    uint32_t numSamples;
+
+    inline void add(const vec3 &sample);
+    inline float displayError() const;
+};
+
+inline void PixelStats::add(const vec3 &sample)
+{
+    sum += sample;
+    const float l = luminance(sample);
+    lumSq += l*l;
+    numSamples++;
+}
+
+// the standard error of the pixel's mean luminance, as it comes out on
+// screen. writePixel takes the square root of the color, which squashes
+// errors in bright pixels and stretches them in dark ones; the slope of
+// sqrt(x) is 1/(2 sqrt(x)). with fewer than two samples there's no telling.
+inline float PixelStats::displayError() const
+{
+    if (numSamples < 2) return FLT_MAX;
+    const float n = numSamples;
+    const float mean = luminance(sum) / n;
+    const float variance = fmaxf(lumSq - mean*mean*n, 0.0f) / (n - 1);
+    const float stdError = sqrtf(variance / n);
+    if (stdError == 0) return 0;
+    return stdError / (2.0f * sqrtf(fmaxf(mean, 1e-6f)));
+}
+
+#endif
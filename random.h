@@ -0,0 +1,57 @@
+#ifndef RANDOMH
+#define RANDOMH
+
+#include <stdint.h>
+
+// Small, fast random number generator; PCG32 (XSH-RR) by M. O'Neill, see
+// https://www.pcg-random.org/. It's 8 bytes of state that lives on the
+// stack of whoever is using it, so threads never share anything, unlike
+// drand48() and its hidden global state.
+//
+// Every sample of every pixel gets its own generator, seeded from the pair
+// (pixel index, sample index). That makes a render come out bit-identical no
+// matter how many threads there are or which thread draws which tile.
+
+class Rng
+{
+public:
+    Rng() : Rng(uint64_t(0)) {}
+    Rng(uint64_t seed) { m_state = 0; next_u32(); m_state += seed; next_u32(); }
+    Rng(uint32_t pixelIndex, uint32_t sampleIndex)
+        : Rng(mix((uint64_t(pixelIndex) << 32) | sampleIndex)) {}
+
+    inline uint32_t next_u32();
+    inline float next_float();
+
+    // splitmix64 finalizer; spreads neighbouring seeds far apart, so pixel n
+    // and pixel n+1 don't get correlated sequences
+    static inline uint64_t mix(uint64_t x);
+
+private:
+    uint64_t m_state;
+};
+
+inline uint32_t Rng::next_u32()
+{
+    const uint64_t old = m_state;
+    m_state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+    const uint32_t rot = uint32_t(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+// uniform in [0,1). the top 24 bits fill a float's mantissa exactly.
+inline float Rng::next_float()
+{
+    return float(next_u32() >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint64_t Rng::mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+#endif
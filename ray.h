@@ -1,7 +1,7 @@
 #ifndef RAYH
 #define RAYH
 
-#include "vector.h"
+// shared by both trees; each one includes it after its own vector.h
 
 class ray
 {
@@ -0,0 +1,47 @@
+// The float tree, built on its own and wrapped in a namespace, so that it
+// can share a binary with the SIMD one (see renderer.h).
+//
+// The system headers the tree's headers include come first, so that they stay
+// out of the namespace; their include guards keep them from being pulled in
+// again inside it. random.h, sampler.h, work_deque.h and the rest of the
+// top-level headers both trees share (ray.h, hitable.h, thread_pool.h,
+// scene_renderer.h...) are left for the tree to pull in, inside the
+// namespace, so each build has its own copy of their inline functions,
+// compiled for its own instruction set. Out here
+// they'd be one function to the linker, and whichever copy it kept is the
+// one every build would run.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <bits/stdc++.h>
+
+#include "macros.h"
+#include "settings.h"
+#include "renderer.h"
+
+namespace float_tree
+{
+#include "float/bvh.h"
+#include "float/wide_bvh.h"
+#include "scene_renderer.h"
+}
+
+Renderer *make_float_renderer(const RenderSettings &settings)
+{
+    return new float_tree::SceneRenderer(settings, "standard float vectors");
+}
@@ -0,0 +1,68 @@
+// The SIMD tree, built on its own and wrapped in a namespace, so that it
+// can share a binary with the float one (see renderer.h). CMakeLists.txt
+// builds this file once for each instruction set, with SIMD_ISA set to
+// sse, avx2 or avx512 and the matching -m flags, which gives simd_sse,
+// simd_avx2 and simd_avx512 and a make_simd_*_renderer() for each. That's
+// all each build leaves global; everything else in it, the standard
+// library's templates included, is its own (see add_isa_object()).
+//
+// The system headers the tree's headers include come first, so that they stay
+// out of the namespace; their include guards keep them from being pulled in
+// again inside it. random.h, sampler.h, work_deque.h and the rest of the
+// top-level headers both trees share (ray.h, hitable.h, thread_pool.h,
+// scene_renderer.h...) are left for the tree to pull in, inside the
+// namespace, so each build has its own copy of their inline functions,
+// compiled for its own instruction set. Out here
+// they'd be one function to the linker, and whichever copy it kept is the
+// one every build would run.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <bits/stdc++.h>
+
+#include "macros.h"
+#include "settings.h"
+#include "renderer.h"
+
+#ifndef SIMD_ISA
+# error "Build this with SIMD_ISA set to sse, avx2 or avx512 (see CMakeLists.txt)"
+#endif
+
+#define SIMD_JOIN(a, b, c) a##b##c
+#define SIMD_NAMESPACE(isa) SIMD_JOIN(simd_, isa, )
+#define SIMD_FACTORY(isa) SIMD_JOIN(make_simd_, isa, _renderer)
+
+#if defined(__AVX512F__)
+    #define SIMD_NAME "SIMD vectors, AVX-512"
+#elif defined(__AVX2__)
+    #define SIMD_NAME "SIMD vectors, AVX2"
+#else
+    #define SIMD_NAME "SIMD vectors, SSE4.1"
+#endif
+
+namespace SIMD_NAMESPACE(SIMD_ISA)
+{
+#include "simd/bvh.h"
+#include "simd/wide_bvh.h"
+#include "scene_renderer.h"
+}
+
+Renderer *SIMD_FACTORY(SIMD_ISA)(const RenderSettings &settings)
+{
+    return new SIMD_NAMESPACE(SIMD_ISA)::SceneRenderer(settings, SIMD_NAME);
+}
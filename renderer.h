@@ -0,0 +1,56 @@
+#ifndef RENDERERH
+#define RENDERERH
+
+#include <stdint.h>
+
+#include "settings.h"
+
+// The float and SIMD trees have their own vec3, Sphere, ThreadPool and so
+// on, with the same names, so they can't both be included in one file. Each
+// is built in a file of its own instead (render_float.cpp, render_simd.cpp),
+// wrapped in a namespace, with the scene and the ThreadPool behind this
+// interface. The SIMD tree is built three times over, once for each
+// instruction set it can use, each in a namespace of its own; dispatch.h
+// picks which of the four to run. main() only talks to it between passes,
+// so none of this is anywhere near the hot loops; those are still built for
+// one tree and one instruction set, and only that.
+class Renderer
+{
+public:
+    virtual ~Renderer() {}
+
+    // "standard float vectors", "SIMD vectors, AVX2" and so on
+    virtual const char *name() = 0;
+
+    // builds the scene, the acceleration structure and the lights, and gets
+    // the pool ready to trace into pFrameBuffer (settings.width x
+    // settings.height, RGBA8). the threads borrow the pool for the build.
+    virtual void setup(uint32_t *pFrameBuffer) = 0;
+    virtual double buildSeconds() = 0;        // on the wall clock
+    virtual uint32_t numSpheres() = 0;
+    virtual uint32_t numNodes() = 0;
+    virtual uint32_t numLights() = 0;
+
+    // these are the ThreadPool's; see thread_pool.h
+    virtual uint32_t getNumThreads() = 0;
+    virtual void setSamples(uint32_t count) = 0;
+    virtual void setAdaptive(bool adaptive) = 0;
+    virtual void clear() = 0;
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    virtual bool running() = 0;
+    virtual uint32_t numTiles() = 0;
+    virtual uint32_t waitForProgress(uint32_t lastSeen, uint32_t timeoutMs) = 0;
+    virtual uint64_t samplesTraced() = 0;
+    virtual uint64_t raysTraced() = 0;
+    virtual void resolve() = 0;
+    virtual void resolveLinear(float *pRGB) = 0;
+    virtual void resolveHeatmap() = 0;
+};
+
+Renderer *make_float_renderer(const RenderSettings &settings);
+Renderer *make_simd_sse_renderer(const RenderSettings &settings);
+Renderer *make_simd_avx2_renderer(const RenderSettings &settings);
+Renderer *make_simd_avx512_renderer(const RenderSettings &settings);
+
+#endif
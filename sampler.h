@@ -0,0 +1,239 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+
+#include <stdint.h>
+
+#include "random.h"
+
+// Where a sample's random numbers come from. Each sample is a point in a
+// space of many dimensions: two for where in the pixel it goes, then a few
+// for each bounce (which light to aim at and where on it, which way to
+// scatter, whether glass reflects or refracts, whether roulette keeps it).
+// Independent random numbers scatter a pixel's samples over that space in
+// clumps and gaps, and the noise only falls as 1/sqrt(samples). The other
+// kinds spread each pixel's samples out evenly over every pair of
+// dimensions, so the noise falls faster.
+//
+//   Random      -- PCG32 (random.h), every number independent of the last
+//   Stratified  -- each pair of dimensions is cut into a grid of
+//                  SAMPLER_STRATA x SAMPLER_STRATA cells, and a pixel's
+//                  samples visit them in a shuffled order, jittered inside
+//   Sobol       -- the 2D Sobol sequence, Owen-scrambled, with its own
+//                  shuffle and scramble for every pixel and pair of
+//                  dimensions (Burley 2020, "Practical Hash-based Owen
+//                  Scrambling")
+//   BlueNoise   -- one such sequence for the whole image, handed out to the
+//                  pixels in runs of SAMPLER_BLUE_NOISE_RUN, in Morton order
+//                  (Ahmed & Wonka 2020). neighbouring pixels get neighbouring
+//                  runs, which between them are spread out evenly too; what
+//                  error is left over is fine-grained (blue) noise instead of
+//                  blotches.
+//
+// The dimensions are handed out in order, as they're asked for. Every
+// bounce starts on a fixed dimension, whatever the bounces before it used,
+// so both integrators and every kind of material stay in step.
+
+enum class SamplerKind : uint8_t { Random, Stratified, Sobol, BlueNoise };
+
+#define SAMPLER_CAMERA_DIMS 2
+// no bounce asks for more than this many (a light is 3, a scatter at most 3,
+// roulette 1)
+#define SAMPLER_BOUNCE_DIMS 8
+#define SAMPLER_STRATA 4
+// works best as the number of samples each pixel ends up with, rounded up to
+// a power of two: then a pixel's whole run, and a block of neighbours' runs,
+// are each spread out evenly
+#define SAMPLER_BLUE_NOISE_RUN 8
+
+class Sampler
+{
+public:
+    Sampler() {}
+    // pixel (x, y)'s sample number sampleIndex; x and y under 65536, which
+    // parse_settings() makes sure of (MAX_IMAGE_SIZE)
+    inline Sampler(SamplerKind kind, uint32_t x, uint32_t y, uint32_t sampleIndex);
+
+    // what follows comes from bounce n's dimensions
+    void startBounce(uint32_t n) { m_dim = SAMPLER_CAMERA_DIMS + n * SAMPLER_BOUNCE_DIMS; }
+
+    // the next dimension, in [0,1)
+    inline float next_float();
+    // the next two dimensions, spread out together
+    inline void next_2d(float &u, float &v);
+
+private:
+    inline uint32_t m_seed(uint32_t dim, uint32_t round) const;
+    inline void m_sobol(uint32_t dim, uint32_t &x, uint32_t &y) const;
+    inline uint32_t m_cell(uint32_t dim, uint32_t numCells) const;
+
+    SamplerKind m_kind;
+    uint32_t m_pixel;     // (y << 16) | x
+    uint32_t m_morton;    // x and y's bits interleaved
+    uint32_t m_index;     // which of the pixel's samples this is
+    uint32_t m_dim;       // the next dimension to hand out
+    Rng m_rng;            // Random's numbers, and Stratified's jitter
+};
+
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// spreads the low 16 bits out to the even bits
+inline uint32_t spread_bits(uint32_t x)
+{
+    x &= 0xFFFFu;
+    x = (x | (x << 8)) & 0x00FF00FFu;
+    x = (x | (x << 4)) & 0x0F0F0F0Fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    return x;
+}
+
+// Owen scrambling, done with a hash: each bit gets flipped or not depending
+// on the seed and every bit above it. Laine and Karras's hash only lets
+// low bits affect higher ones, so it's run on the bits backwards.
+inline uint32_t owen_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// the first two dimensions of the Sobol sequence, as 32-bit fractions
+inline uint32_t sobol0(uint32_t i) { return reverse_bits(i); }
+inline uint32_t sobol1(uint32_t i)
+{
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+        if (i & 1) r ^= v;
+    return r;
+}
+
+// Kensler's hash permutation ("Correlated Multi-Jittered Sampling", 2013):
+// where i goes, among 0..n-1, in a shuffle picked by seed
+inline uint32_t permute(uint32_t i, uint32_t n, uint32_t seed)
+{
+    uint32_t w = n - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do
+    {
+        i ^= seed; i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8; i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1; i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + seed) % n;
+}
+
+// a 32-bit fraction as a float in [0,1)
+inline float to_unit_float(uint32_t x)
+{
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+
+inline Sampler::Sampler(SamplerKind kind, uint32_t x, uint32_t y, uint32_t sampleIndex)
+    : m_kind(kind), m_pixel((y << 16) | x), m_morton(spread_bits(x) | (spread_bits(y) << 1)),
+      m_index(sampleIndex), m_dim(0), m_rng(m_pixel, sampleIndex) {}
+
+// a seed for each pair of dimensions. for BlueNoise it's the same all over
+// the image, and round says which time around the pixel's run this is.
+inline uint32_t Sampler::m_seed(uint32_t dim, uint32_t round) const
+{
+    const uint64_t who = (m_kind == SamplerKind::BlueNoise)? round : (uint64_t(m_pixel) << 8 | round);
+    return uint32_t(Rng::mix(who << 24 | dim));
+}
+
+// both dimensions of a scrambled Sobol point, for the pair starting at dim
+inline void Sampler::m_sobol(uint32_t dim, uint32_t &x, uint32_t &y) const
+{
+    uint32_t index = m_index, round = 0;
+    if (m_kind == SamplerKind::BlueNoise)
+    {
+        index = m_morton * SAMPLER_BLUE_NOISE_RUN + m_index % SAMPLER_BLUE_NOISE_RUN;
+        round = m_index / SAMPLER_BLUE_NOISE_RUN;
+    }
+    const uint32_t seed = m_seed(dim, round);
+    index = owen_scramble(index, seed);
+    x = owen_scramble(sobol0(index), seed * 0x9E3779B9u + 1);
+    y = owen_scramble(sobol1(index), seed * 0x85EBCA6Bu + 2);
+}
+
+// which of numCells cells the sample goes in, for the dimensions starting at
+// dim. every run of numCells samples visits each cell once.
+inline uint32_t Sampler::m_cell(uint32_t dim, uint32_t numCells) const
+{
+    return permute(m_index % numCells, numCells, m_seed(dim, m_index / numCells));
+}
+
+inline float Sampler::next_float()
+{
+    const uint32_t dim = m_dim++;
+    switch (m_kind)
+    {
+        case SamplerKind::Random:
+            return m_rng.next_float();
+        case SamplerKind::Stratified:
+        {
+            const uint32_t numCells = SAMPLER_STRATA * SAMPLER_STRATA;
+            return (m_cell(dim, numCells) + m_rng.next_float()) * (1.0f / numCells);
+        }
+        case SamplerKind::Sobol:
+        case SamplerKind::BlueNoise:
+        {
+            uint32_t x, y;
+            m_sobol(dim, x, y);
+            return to_unit_float(x);
+        }
+    }
+    return 0;
+}
+
+inline void Sampler::next_2d(float &u, float &v)
+{
+    const uint32_t dim = m_dim;
+    m_dim += 2;
+    switch (m_kind)
+    {
+        case SamplerKind::Random:
+            u = m_rng.next_float();
+            v = m_rng.next_float();
+            return;
+        case SamplerKind::Stratified:
+        {
+            const uint32_t cell = m_cell(dim, SAMPLER_STRATA * SAMPLER_STRATA);
+            u = (cell % SAMPLER_STRATA + m_rng.next_float()) * (1.0f / SAMPLER_STRATA);
+            v = (cell / SAMPLER_STRATA + m_rng.next_float()) * (1.0f / SAMPLER_STRATA);
+            return;
+        }
+        case SamplerKind::Sobol:
+        case SamplerKind::BlueNoise:
+        {
+            uint32_t x, y;
+            m_sobol(dim, x, y);
+            u = to_unit_float(x);
+            v = to_unit_float(y);
+            return;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef SCENERENDERERH
+#define SCENERENDERERH
+
+#include <chrono>
+#include <vector>
+
+#include "renderer.h"
+#include "lights.h"
+#include "thread_pool.h"
+
+// The scene, and the ThreadPool that renders it, behind the Renderer
+// interface (see renderer.h). Both trees share it: render_float.cpp and
+// render_simd.cpp include it in their namespaces, after the tree's own
+// bvh.h and wide_bvh.h.
+class SceneRenderer : public Renderer
+{
+public:
+    SceneRenderer(const RenderSettings &settings, const char *name);
+    ~SceneRenderer();
+
+    const char *name() { return m_name; }
+    void setup(uint32_t *pFrameBuffer);
+    double buildSeconds() { return m_buildSeconds; }
+    uint32_t numSpheres() { return m_numSpheres; }
+    uint32_t numNodes() { return m_numNodes; }
+    uint32_t numLights() { return m_lights.size(); }
+
+    uint32_t getNumThreads() { return m_pool.getNumThreads(); }
+    void setSamples(uint32_t count) { m_pool.setSamples(count); }
+    void setAdaptive(bool adaptive) { m_pool.setAdaptive(adaptive); }
+    void clear() { m_pool.clear(); }
+    void start() { m_pool.start(); }
+    void stop() { m_pool.stop(); }
+    bool running() { return m_pool.running(); }
+    uint32_t numTiles() { return m_pool.num_total(); }
+    uint32_t waitForProgress(uint32_t lastSeen, uint32_t timeoutMs) { return m_pool.waitForProgress(lastSeen, timeoutMs); }
+    uint64_t samplesTraced() { return m_pool.samplesTraced(); }
+    uint64_t raysTraced() { return m_pool.raysTraced(); }
+    void resolve() { m_pool.resolve(); }
+    void resolveLinear(float *pRGB) { m_pool.resolveLinear(pRGB); }
+    void resolveHeatmap() { m_pool.resolveHeatmap(); }
+
+private:
+    void m_addField();
+
+    const char *m_name;
+    RenderSettings m_settings;
+    ThreadPool m_pool;
+    MaterialTable m_materials;
+    std::vector<Sphere*> m_spheres;      // only until the BVH and the lights have their copies
+    Hitable *m_pWorld = nullptr;
+    uint32_t m_numSpheres = 0, m_numNodes = 0;
+    double m_buildSeconds = 0;
+    Camera m_cam;
+    LightList m_lights;
+    std::vector<PixelStats> m_accum;
+    threadInfo m_info;
+};
+
+
+SceneRenderer::SceneRenderer(const RenderSettings &settings, const char *name)
+    : m_name(name), m_settings(settings), m_pool(settings.numThreads, SCHEDULING),
+      m_cam(vec3(-1,0,2), vec3(0,0,-1), vec3(0,1,0), 70, (float)settings.width/settings.height)
+{
+    m_pool.setIntegrator(settings.integrator);
+    m_pool.setResolution(settings.width, settings.height);
+    m_pool.setMaxBounces(settings.maxBounces);
+}
+
+SceneRenderer::~SceneRenderer()
+{
+    if (m_pool.running()) m_pool.stop();
+    delete m_pWorld;
+}
+
+void SceneRenderer::setup(uint32_t *pFrameBuffer)
+{
+    m_spheres.push_back(new Sphere(vec3( 0,   100.6, -2  ), 100, m_materials.add(Diffuse(   vec3(0.3, 0.5, 0.7)                ))));
+    m_spheres.push_back(new Sphere(vec3( 0,     0,   -2  ), 0.5, m_materials.add(Diffuse(   vec3(0.8, 0.3, 0.3)                ))));
+    m_spheres.push_back(new Sphere(vec3( 2.6,  -1.4, -1.7), 0.7, m_materials.add(Metal(     vec3(0.7, 0.7, 0.7),   0.4         ))));
+    m_spheres.push_back(new Sphere(vec3( 1,     0,   -2  ), 0.4, m_materials.add(Metal(     vec3(0.3, 0.4, 0.9),   0.05        ))));
+    m_spheres.push_back(new Sphere(vec3(-0.3,   0.1, -1  ), 0.3, m_materials.add(Glass(     vec3(0.5, 1.0, 0.6),   0.9         ))));
+    m_spheres.push_back(new Sphere(vec3( 0,     0.2,  1  ), 0.3, m_materials.add(Glass(     vec3(0.8, 0.2, 0.3),   0.0         ))));
+    m_spheres.push_back(new Sphere(vec3(-1,    -0.3, -1.2), 0.2, m_materials.add(Emmissive( vec3(0.3, 0.2, 0.0),   9.0,  false ))));
+    m_spheres.push_back(new Sphere(vec3( 0.3,  -0.5, -1.1), 0.2, m_materials.add(Emmissive( vec3(0.0, 0.1, 0.9),  10.0,  false ))));
+    m_spheres.push_back(new Sphere(vec3( 0,    -5.0, -3  ), 2.0, m_materials.add(Emmissive( vec3(1.0, 1.0, 1.0),   1.0,  false ))));
+
+    m_addField();
+
+    // the lights next event estimation aims its shadow rays at. this can
+    // give spheres materials of their own, so it goes before the BVH copies
+    // them
+    m_lights = LightList(m_spheres.data(), m_spheres.size(), m_materials);
+
+    // the render threads don't exist until start(), so the BVH build has the
+    // pool's parallel_for() helpers to itself. it's timed on the wall clock,
+    // since clock() adds up every thread's time.
+    auto buildStart = std::chrono::steady_clock::now();
+    switch (m_settings.accel)
+    {
+        case Accel::BVH2:
+        {
+            BVH *pBVH = new BVH(m_spheres.data(), m_spheres.size(), &m_pool);
+            m_numNodes = pBVH->numNodes();
+            m_pWorld = pBVH;
+            break;
+        }
+        case Accel::BVH4:
+        {
+            WideBVH<4> *pBVH = new WideBVH<4>(m_spheres.data(), m_spheres.size(), &m_pool);
+            m_numNodes = pBVH->numNodes();
+            m_pWorld = pBVH;
+            break;
+        }
+        case Accel::BVH8:
+        {
+            WideBVH<8> *pBVH = new WideBVH<8>(m_spheres.data(), m_spheres.size(), &m_pool);
+            m_numNodes = pBVH->numNodes();
+            m_pWorld = pBVH;
+            break;
+        }
+    }
+    m_buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+
+    // both of those keep their own copies of the spheres, so these can go
+    m_numSpheres = m_spheres.size();
+    for (Sphere *pSphere : m_spheres) delete pSphere;
+    m_spheres.clear();
+    m_spheres.shrink_to_fit();
+
+    m_accum.resize(size_t(m_settings.width) * m_settings.height);
+    m_info = threadInfo {
+        m_pWorld,
+        &m_materials,
+        &m_lights,
+        &m_cam,
+        m_accum.data(),
+        pFrameBuffer
+    };
+    m_pool.init(&m_info);
+}
+
+// the field of little spheres over the ground that settings.scene adds
+// (see SceneKind). they sit on top of the big ground sphere, whose surface
+// curves away from y=0.6 the further out they are.
+void SceneRenderer::m_addField()
+{
+    int count = 0;
+    switch (m_settings.scene)
+    {
+        case SceneKind::Default: count = NUM_EXTRA_SPHERES; break;
+        case SceneKind::Spheres: count = 100000; break;
+        case SceneKind::Glass:   count = 400; break;
+        case SceneKind::Lights:  count = 300; break;
+    }
+    Rng sceneRng(1);
+    for (int i = 0; i < count; i++)
+    {
+        const float x = 24.0f * sceneRng.next_float() - 12.0f;
+        const float z = -14.0f * sceneRng.next_float() + 1.5f;
+        float r = 0.02f + 0.06f * sceneRng.next_float();
+        // the glass ones are bigger, so that more rays go through them
+        if (m_settings.scene == SceneKind::Glass) r *= 2;
+        const float ground = 100.6f - sqrt(100.0f*100.0f - x*x - (z+2)*(z+2));
+        const vec3 albedo(sceneRng.next_float(), sceneRng.next_float(), sceneRng.next_float());
+        uint32_t mat;
+        if (m_settings.scene == SceneKind::Glass)
+            mat = m_materials.add(Glass(0.5f * albedo + vec3(0.5, 0.5, 0.5), 1.5f));
+        else if (m_settings.scene == SceneKind::Lights)
+            mat = m_materials.add(Emmissive(albedo, 2.0f + 8.0f * sceneRng.next_float(), false));
+        else if (sceneRng.next_float() < 0.8f) mat = m_materials.add(Diffuse(albedo));
+        else mat = m_materials.add(Metal(albedo, 0.3f * sceneRng.next_float()));
+        m_spheres.push_back(new Sphere(vec3(x, ground - r, z), r, mat));
+    }
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef SETTINGSH
+#define SETTINGSH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <initializer_list>
+
+#include "macros.h"
+
+// How tiles get handed out to the threads.
+//   SharedCounter -- every thread takes the next tile off one atomic counter.
+//   WorkStealing  -- every thread starts with an even share of the tiles in
+//                    its own deque, and steals from random other threads once
+//                    it runs dry. Keeps threads busy when some parts of the
+//                    image (glass, metal) cost far more than others (sky).
+enum class Scheduling { SharedCounter, WorkStealing };
+
+// How a tile's pixels get traced.
+//   Megakernel -- one path at a time, start to finish (ThreadPool::color()).
+//   Wavefront  -- every sample in the tile at once, a bounce at a time, with
+//                 the hits shaded material by material (see wavefront.h).
+// They draw exactly the same image; only the speed differs.
+enum class Integrator { Megakernel, Wavefront };
+
+// What the scene is traced against: the binary BVH, or the 4- or 8-wide one.
+enum class Accel { BVH2, BVH4, BVH8 };
+
+// What's rendered. All of them start from the same nine spheres, and add a
+// field of small ones over the ground, placed by an Rng with a fixed seed so
+// that every run gets exactly the same scene.
+//   Default -- NUM_EXTRA_SPHERES diffuse and metal ones (none, as shipped)
+//   Spheres -- 100k diffuse and metal ones, for the acceleration structures
+//   Glass   -- 400 glass ones, for long refracting paths
+//   Lights  -- 300 glowing ones, for next event estimation's light picking
+enum class SceneKind { Default, Spheres, Glass, Lights };
+
+// Which build of the tracer renders it (see dispatch.h).
+//   Auto    -- the fastest one this CPU can run
+//   Scalar  -- the float tree; runs anywhere
+//   SSE     -- the SIMD tree, built for SSE4.1
+//   AVX2    -- the SIMD tree, built for AVX2 and FMA
+//   AVX512  -- the SIMD tree, built for AVX-512 (F, VL, DQ and BW), with
+//              16-wide BVH leaves
+enum class Backend { Auto, Scalar, SSE, AVX2, AVX512 };
+
+// Everything about a render that can change without rebuilding. The
+// defaults are the ones in macros.h, which is still where to change them for
+// good; the command line (parse_settings()) overrides them for one run, so
+// sweeps over sizes, sample counts or thread counts all run from one binary.
+//
+// What stays in macros.h is what the hot loops are built around: tile and
+// packet sizes (stack arrays, and loops the compiler unrolls), the adaptive
+// sampling thresholds, and on/off switches that are read once per path.
+// the largest --width and --height. the sampler keeps a pixel's x and y in
+// 16 bits each, and past that, pixels would start sharing sample sequences
+#define MAX_IMAGE_SIZE 65535
+
+struct RenderSettings
+{
+    int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+    int samples = NUM_ALIAS_STEPS;          // per pixel, on average
+    int maxBounces = MAX_NUM_REFLECTIONS;   // per path, before roulette
+    int numThreads = NUM_THREADS;
+    Backend backend = BACKEND;
+    SceneKind scene = SceneKind::Default;
+    Accel accel = Accel::BVH8;
+    Integrator integrator = INTEGRATOR;
+    const char *output = nullptr;           // where to save the image, if anywhere
+    bool headless = false;                  // no window
+};
+
+inline const char *accel_name(Accel accel)
+{
+    switch (accel)
+    {
+        case Accel::BVH2: return "bvh2";
+        case Accel::BVH4: return "bvh4";
+        case Accel::BVH8: return "bvh8";
+    }
+    return "?";
+}
+
+inline const char *scene_name(SceneKind scene)
+{
+    switch (scene)
+    {
+        case SceneKind::Default: return "default";
+        case SceneKind::Spheres: return "spheres";
+        case SceneKind::Glass:   return "glass";
+        case SceneKind::Lights:  return "lights";
+    }
+    return "?";
+}
+
+inline const char *backend_name(Backend backend)
+{
+    switch (backend)
+    {
+        case Backend::Auto:   return "auto";
+        case Backend::Scalar: return "scalar";
+        case Backend::SSE:    return "sse";
+        case Backend::AVX2:   return "avx2";
+        case Backend::AVX512: return "avx512";
+    }
+    return "?";
+}
+
+inline const char *integrator_name(Integrator integrator)
+{
+    return (integrator == Integrator::Wavefront)? "wavefront" : "megakernel";
+}
+
+// an option's number, which has to be from min to max
+inline bool parse_int(const char *option, const char *value, int min, int max, int &out)
+{
+    char *end;
+    const long n = strtol(value, &end, 10);
+    if (*value == 0 || *end != 0 || n < min || n > max)
+    {
+        fprintf(stderr, "%s needs a whole number from %d to %d (not '%s').\n", option, min, max, value);
+        return false;
+    }
+    out = int(n);
+    return true;
+}
+
+// reads argv into settings. the first argument without dashes picks the
+// acceleration structure (bvh2, bvh4 or bvh8), and the second the
+// integrator (megakernel or wavefront). these can go anywhere among them:
+//   --width N, --height N  the image's size, up to MAX_IMAGE_SIZE each
+//   --samples N            samples per pixel, on average
+//   --bounces N            the most bounces a path can take
+//   --threads N            render threads (at most one less than the cores)
+//   --scene NAME           default, spheres, glass or lights
+//   --backend NAME         auto (the default), or one of scalar, sse, avx2
+//                          and avx512 to force it, for comparing them
+//   --output FILE          saves the finished image; .png, .ppm or .exr
+//   --headless             no window, and no SDL at all: renders, saves the
+//                          image (to render.png without --output) and exits.
+//                          for machines with no display, and job scripts.
+// prints what's wrong and returns false if anything is.
+inline bool parse_settings(int argc, char **argv, RenderSettings &settings)
+{
+    int numPositional = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc)? argv[i + 1] : nullptr;
+        bool ok = true;
+        if (strcmp(arg, "--headless") == 0) { settings.headless = true; continue; }
+        if (strncmp(arg, "--", 2) != 0)
+        {
+            if (numPositional == 0)
+            {
+                if      (strcmp(arg, "bvh2") == 0) settings.accel = Accel::BVH2;
+                else if (strcmp(arg, "bvh4") == 0) settings.accel = Accel::BVH4;
+                else if (strcmp(arg, "bvh8") == 0) settings.accel = Accel::BVH8;
+                else
+                {
+                    fprintf(stderr, "Unknown acceleration structure '%s' (try bvh2, bvh4 or bvh8).\n", arg);
+                    return false;
+                }
+            }
+            else if (numPositional == 1)
+            {
+                if      (strcmp(arg, "megakernel") == 0) settings.integrator = Integrator::Megakernel;
+                else if (strcmp(arg, "wavefront") == 0)  settings.integrator = Integrator::Wavefront;
+                else
+                {
+                    fprintf(stderr, "Unknown integrator '%s' (try megakernel or wavefront).\n", arg);
+                    return false;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "Too many arguments ('%s').\n", arg);
+                return false;
+            }
+            numPositional++;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Unknown or incomplete option '%s'.\n", arg);
+            return false;
+        }
+        i++;
+        if      (strcmp(arg, "--width") == 0)   ok = parse_int(arg, value, 1, MAX_IMAGE_SIZE, settings.width);
+        else if (strcmp(arg, "--height") == 0)  ok = parse_int(arg, value, 1, MAX_IMAGE_SIZE, settings.height);
+        else if (strcmp(arg, "--samples") == 0) ok = parse_int(arg, value, 1, 1 << 30, settings.samples);
+        else if (strcmp(arg, "--bounces") == 0) ok = parse_int(arg, value, 1, 1 << 30, settings.maxBounces);
+        else if (strcmp(arg, "--threads") == 0) ok = parse_int(arg, value, 1, 1 << 30, settings.numThreads);
+        else if (strcmp(arg, "--output") == 0)  settings.output = value;
+        else if (strcmp(arg, "--scene") == 0)
+        {
+            bool found = false;
+            for (SceneKind k : { SceneKind::Default, SceneKind::Spheres, SceneKind::Glass, SceneKind::Lights })
+                if (strcmp(value, scene_name(k)) == 0) { settings.scene = k; found = true; }
+            if (!found)
+            {
+                fprintf(stderr, "Unknown scene '%s' (try default, spheres, glass or lights).\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--backend") == 0)
+        {
+            bool found = false;
+            for (Backend b : { Backend::Auto, Backend::Scalar, Backend::SSE, Backend::AVX2, Backend::AVX512 })
+                if (strcmp(value, backend_name(b)) == 0) { settings.backend = b; found = true; }
+            if (!found)
+            {
+                fprintf(stderr, "Unknown backend '%s' (try auto, scalar, sse, avx2 or avx512).\n", value);
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown or incomplete option '%s'.\n", arg);
+            return false;
+        }
+        if (!ok) return false;
+    }
+    if (settings.headless && !settings.output) settings.output = "render.png";
+    return true;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef AABBH
+#define AABBH
+
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+#include "vector.h"
+#include "../ray.h"
+
+// Axis-aligned bounding box, i.e. the smallest box (with sides parallel to
+// the axes) that something fits in. Cheap to test a ray against, so they're
+// what the BVH is made of.
+
+class aabb
+{
+public:
+    // starts out "inside out", so growing it by anything gives that thing's box
+    aabb() : minimum(_mm_set1_ps(FLT_MAX)), maximum(_mm_set1_ps(-FLT_MAX)) {}
+    aabb(const vec3 &a, const vec3 &b) : minimum(a), maximum(b) {}
+
+    inline void grow(const vec3 &p);
+    inline void grow(const aabb &b);
+    inline vec3 centroid() const { return 0.5f * (minimum + maximum); }
+    inline float surface_area() const;
+    inline int longest_axis() const;
+
+    vec3 minimum;
+    vec3 maximum;
+};
+
+inline void aabb::grow(const vec3 &p)
+{
+    minimum.xmm = _mm_min_ps(minimum.xmm, p.xmm);
+    maximum.xmm = _mm_max_ps(maximum.xmm, p.xmm);
+}
+
+inline void aabb::grow(const aabb &b)
+{
+    minimum.xmm = _mm_min_ps(minimum.xmm, b.minimum.xmm);
+    maximum.xmm = _mm_max_ps(maximum.xmm, b.maximum.xmm);
+}
+
+inline float aabb::surface_area() const
+{
+    const vec3 d = maximum - minimum;
+    // an empty box has max < min; call that zero
+    if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+    return 2.0f * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+inline int aabb::longest_axis() const
+{
+    const vec3 d = maximum - minimum;
+    if (d.x() > d.y() && d.x() > d.z()) return 0;
+    return (d.y() > d.z())? 1 : 2;
+}
+
+// "slab" test: clip the ray's [tMin,tMax] against the pair of planes on each
+// axis; if anything's left over, the ray goes through the box. invDir is
+// 1/direction, worked out once per ray. returns the distance at which the ray
+// enters the box in tEntry.
+//
+// bmin and bmax are read as four floats each; whatever's in the fourth is
+// ignored.
+inline bool slab_test(const float *bmin, const float *bmax, const vec3 &origin, const vec3 &invDir,
+                      float tMin, float tMax, float &tEntry)
+{
+    const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmin), origin.xmm), invDir.xmm);
+    const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmax), origin.xmm), invDir.xmm);
+    // near and far plane on each axis. the fourth lane is replaced with
+    // tMin/tMax, which also folds them into the reductions below.
+    __m128 tNear = _mm_blend_ps(_mm_min_ps(t0, t1), _mm_set1_ps(tMin), 0x8);
+    __m128 tFar  = _mm_blend_ps(_mm_max_ps(t0, t1), _mm_set1_ps(tMax), 0x8);
+    // the ray is in the box from the last plane it enters to the first it
+    // leaves
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2,3,0,1)));
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1,0,3,2)));
+    tFar  = _mm_min_ps(tFar,  _mm_shuffle_ps(tFar,  tFar,  _MM_SHUFFLE(2,3,0,1)));
+    tFar  = _mm_min_ps(tFar,  _mm_shuffle_ps(tFar,  tFar,  _MM_SHUFFLE(1,0,3,2)));
+    tEntry = _mm_cvtss_f32(tNear);
+    return _mm_comile_ss(tNear, tFar);
+}
+
+#endif
@@ -2,7 +2,8 @@
 #define CAMERAH
 
 #include "vector.h"
-#include "ray.h"
+#include "../ray.h"
+#include "ray_packet.h"
 
 class Camera
 {
@@ -11,6 +12,8 @@ public:
 
     ray getRay(float u, float v)
     { return ray(world_origin, camera_origin + u*horizontal + v*vertical - world_origin); }
+    // getRay() for a whole packet; u and v have one entry per ray
+    void getRays(const float *u, const float *v, RayPacket &packet);
 
     vec3 world_origin;
     vec3 camera_origin;
@@ -32,4 +35,21 @@ Camera::Camera(vec3 lookfrom, vec3 lookat, vec3 up, float vfov, float aspect)
     vertical = 2 * half_height * v;
 }
 
+void Camera::getRays(const float *u, const float *v, RayPacket &packet)
+{
+    // same sums as getRay(), in the same order, just four rays at a time
+    const vec3x4 o(world_origin), co(camera_origin), h(horizontal), vt(vertical);
+    for (int g = 0; g < PACKET_GROUPS; g++)
+    {
+        const vec3x4 d = co + _mm_loadu_ps(u + 4*g) * h + _mm_loadu_ps(v + 4*g) * vt - o;
+        _mm_store_ps(packet.ox + 4*g, o.x); _mm_store_ps(packet.oy + 4*g, o.y); _mm_store_ps(packet.oz + 4*g, o.z);
+        _mm_store_ps(packet.dx + 4*g, d.x); _mm_store_ps(packet.dy + 4*g, d.y); _mm_store_ps(packet.dz + 4*g, d.z);
+        const __m128 one = _mm_set1_ps(1.0f);
+        _mm_store_ps(packet.ix + 4*g, _mm_div_ps(one, d.x));
+        _mm_store_ps(packet.iy + 4*g, _mm_div_ps(one, d.y));
+        _mm_store_ps(packet.iz + 4*g, _mm_div_ps(one, d.z));
+        _mm_store_ps(packet.tMax + 4*g, _mm_set1_ps(FLT_MAX));
+    }
+}
+
 #endif
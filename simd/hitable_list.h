@@ -1,34 +1,54 @@
 #ifndef HITABLELISTH
 #define HITABLELISTH
 
-#include "hitable.h"
+#include "vector.h"
+#include "ray_packet.h"
+#include "../hitable.h"
 
 class HitableList : public Hitable
 {
 public:
     HitableList() {}
     HitableList(Hitable **l, int n) { list = l; list_size = n; }
-    bool hit(const ray &pRayIn, float tMin, float tMax, hit_record &pRec) const;
+    bool intersect(const ray &pRayIn, float tMin, float tMax, hit_info &info) const override;
+    bool occluded(const ray &pRayIn, float tMin, float tMax) const override;
+    void intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const override;
 
     Hitable **list;
     int list_size;
 };
 
-bool HitableList::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+// a child only touches info when it finds something closer, so there's no
+// need for a temporary; whichever child wrote it last has the closest hit,
+// and resolves it itself
+bool HitableList::intersect(const ray& r, float t_min, float t_max, hit_info& info) const
 {
-    hit_record temp_rec;
     bool hit_anything = false;
     float closest_so_far = t_max;
     for (int i = 0; i < list_size; i++)
     {
-        if (list[i]->hit(r, t_min, closest_so_far, temp_rec))
+        if (list[i]->intersect(r, t_min, closest_so_far, info))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = info.t;
         }
     }
     return hit_anything;
 }
 
+bool HitableList::occluded(const ray& r, float t_min, float t_max) const
+{
+    for (int i = 0; i < list_size; i++)
+        if (list[i]->occluded(r, t_min, t_max)) return true;
+    return false;
+}
+
+// each child only writes the rays it hits closer than anything before it,
+// so this works out the same as intersect() does, ray by ray
+void HitableList::intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const
+{
+    for (int i = 0; i < list_size; i++)
+        list[i]->intersect_packet(packet, tMin, pInfos);
+}
+
 #endif
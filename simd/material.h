@@ -4,196 +4,258 @@
 #include <bits/stdc++.h>
 #include <cmath>
 #include "vector.h"
-#include "ray.h"
-#include "hitable.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
 
-class Material
+// Materials are plain records, all kept side by side in one MaterialTable,
+// and hits refer to them by their index in it. What a material does is
+// picked by a switch on its kind (see scatter() at the bottom) instead of a
+// virtual call, so the bounce loop has no indirect branches to mispredict
+// and no scattered heap objects to chase.
+
+enum class MaterialKind : uint8_t { Diffuse, Metal, Emmissive, Glass, Translucent, Normals };
+#define NUM_MATERIAL_KINDS 6
+
+struct Material
+{
+    vec3 albedo;
+    // the one number each kind has; which one depends on the kind
+    union
+    {
+        float fuzz;           // Metal
+        float strength;       // Emmissive
+        float ref_idx;        // Glass
+        float translucency;   // Translucent
+    };
+    float scattering;         // Translucent
+    MaterialKind kind;
+    bool continueTracing;     // Emmissive
+};
+
+class MaterialTable
 {
 public:
-    virtual bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const = 0;
+    // returns the new material's id
+    uint32_t add(const Material &m) { m_materials.push_back(m); return m_materials.size() - 1; }
+    const Material &operator[](uint32_t id) const { return m_materials[id]; }
+    uint32_t size() const { return m_materials.size(); }
+
+private:
+    std::vector<Material> m_materials;
 };
 
 
 // Diffuse -- Lambertian diffuse material. Simulates a rough, matte material.
-class Diffuse : public Material
+inline Material Diffuse(const vec3& a)
 {
-public:
-    Diffuse(const vec3& a) : albedo(a) {}
+    Material m = {};
+    m.kind = MaterialKind::Diffuse;
+    m.albedo = a;
+    return m;
+}
 
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
-    {
-        vec3 target = pRec.normal + random_in_unit_sphere();
-        pRayIn = ray(pRec.p, target);
-        pAttenuation = albedo;
-        isLightSource = false;
-        return true;
-    }
+// the normal plus a point on (not in) the unit sphere gives directions with
+// a cosine falloff from the normal, which is exactly what a Lambertian
+// surface reflects; then the albedo is all there is to the attenuation, and
+// the pdf is simple enough for next event estimation to weigh against.
+inline bool scatter_diffuse(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    pRayIn = ray(pRec.p, random_cosine_direction(pRec.normal, sampler));
+    pAttenuation = m.albedo;
+    isLightSource = false;
+    return true;
+}
 
-    vec3 albedo;
-};
 
 // Metal -- Reflects incoming rays mirrored across the normal vector. Simulates a mirror finish.
-class Metal : public Material
+inline Material Metal(const vec3& a, const float f)
 {
-public:
-    Metal(const vec3& a, const float f) : albedo(a) { if (f<1) fuzz = f; else fuzz = 1; }
+    Material m = {};
+    m.kind = MaterialKind::Metal;
+    m.albedo = a;
+    if (f<1) m.fuzz = f; else m.fuzz = 1;
+    return m;
+}
 
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
-    {
-        vec3 reflected = reflect(normalize(pRayIn.direction()), pRec.normal);
-        pRayIn = ray(pRec.p, reflected + fuzz*random_in_unit_sphere());
-        pAttenuation = albedo;
-        isLightSource = false;
-        return (dot(pRayIn.direction(), pRec.normal) > 0);
-    }
-
-    vec3 albedo;
-    float fuzz;
-};
+inline bool scatter_metal(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    vec3 reflected = reflect(normalize(pRayIn.direction()), pRec.normal);
+    pRayIn = ray(pRec.p, reflected + m.fuzz*random_in_unit_sphere(sampler));
+    pAttenuation = m.albedo;
+    isLightSource = false;
+    return (dot(pRayIn.direction(), pRec.normal) > 0);
+}
 
 
 // Emmissive-- Emits more light than it receives
-class Emmissive : public Material
+inline Material Emmissive(const vec3& a, const float s, const bool c)
 {
-public:
-    Emmissive(const vec3& a, const float s, const bool c) : albedo(a), strength(s), continueTracing(c) {}
-
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
-    {
-        vec3 target = pRec.normal + random_in_unit_sphere();
-        pRayIn = ray(pRec.p, target);
-        pAttenuation = albedo * strength;
-        isLightSource = true;
-        return continueTracing;
-    }
+    Material m = {};
+    m.kind = MaterialKind::Emmissive;
+    m.albedo = a;
+    m.strength = s;
+    m.continueTracing = c;
+    return m;
+}
 
-    vec3 albedo;
-    float strength;
-    bool continueTracing;
-};
+inline bool scatter_emmissive(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    vec3 target = pRec.normal + random_in_unit_sphere(sampler);
+    pRayIn = ray(pRec.p, target);
+    pAttenuation = m.albedo * m.strength;
+    isLightSource = true;
+    return m.continueTracing;
+}
 
 
 // Glass - Calculates internal reflections and refractions
-class Glass : public Material
+inline Material Glass(const vec3& a, const float ri)
 {
-public:
-    Glass(const vec3& a, const float ri) : albedo(a), ref_idx(ri) {}
+    Material m = {};
+    m.kind = MaterialKind::Glass;
+    m.albedo = a;
+    m.ref_idx = ri;
+    return m;
+}
 
-    // This was stolen from Peter Shirley's Ray Tracing in One Weekend. Don't
-    // ask me how it works. I have a basic understanding but not enough to
-    // teach anyone else.
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
-    {
-        const vec3 pRayInD = pRayIn.direction();
-        vec3 outward_normal;
-        vec3 reflected = reflect(pRayInD, pRec.normal);
-        float ni_over_nt;
-        pAttenuation = albedo;
-        vec3 refracted;
-        float reflect_prob;
-        float cosine;
-        if (dot(pRayInD, pRec.normal) > 0)
-        {
-            outward_normal = -pRec.normal;
-            ni_over_nt = ref_idx;
-            cosine = ref_idx * dot(pRayInD, pRec.normal) / pRayInD.length();
-        }
-        else
-        {
-            outward_normal = pRec.normal;
-            ni_over_nt = 1.0f / ref_idx;
-            cosine = -dot(pRayInD, pRec.normal) / pRayInD.length();
-        }
-        if (this->refract(pRayInD, outward_normal, ni_over_nt, refracted))
-        {
-            reflect_prob = this->schlick(cosine, ref_idx);
-        }
-        else reflect_prob = 1.0f;
-        pRayIn = ray(pRec.p, (drand48() < reflect_prob)? reflected : refracted);
-        isLightSource = false;
+// Glass has reflectivity that varies with viewing angle. this is a massive
+// ugly equation, but luckily Christophe Schlick came up with this simple
+// polynomial approximation.
+inline float schlick(float cosine, float ref_idx)
+{
+    float r0 = (1-ref_idx) / (1+ref_idx);
+    r0 = r0*r0;
+    return r0 + (1-r0)*pow((1 - cosine), 5);
+}
+
+// determines whether the viewing angle is steep enough for total internal
+// reflection (zero refraction) and refracts. this math is loosely based on
+// snells law:   n sin(theta) = n' sin(theta')
+// common values:  air=1, glass=1.3-1.7, diamond=2.4
+inline bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted)
+{
+    vec3 uv = normalize(v);
+    float dt = dot(uv, n);
+    float discriminant = 1.0f - ni_over_nt*ni_over_nt*(1-dt*dt);
+    if (discriminant > 0) {
+        refracted = ni_over_nt*(uv - n*dt) - n*sqrt(discriminant);
         return true;
     }
+    else return false;
+}
 
-    // Glass has reflectivity that varies with viewing angle. this is a massive
-    // ugly equation, but luckily Christophe Schlick came up with this simple
-    // polynomial approximation.
-    float schlick(float cosine, float ref_idx) const
+// This was stolen from Peter Shirley's Ray Tracing in One Weekend. Don't
+// ask me how it works. I have a basic understanding but not enough to
+// teach anyone else.
+inline bool scatter_glass(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    const vec3 pRayInD = pRayIn.direction();
+    vec3 outward_normal;
+    vec3 reflected = reflect(pRayInD, pRec.normal);
+    float ni_over_nt;
+    pAttenuation = m.albedo;
+    vec3 refracted;
+    float reflect_prob;
+    float cosine;
+    if (dot(pRayInD, pRec.normal) > 0)
     {
-        float r0 = (1-ref_idx) / (1+ref_idx);
-        r0 = r0*r0;
-        return r0 + (1-r0)*pow((1 - cosine), 5);
+        outward_normal = -pRec.normal;
+        ni_over_nt = m.ref_idx;
+        cosine = m.ref_idx * dot(pRayInD, pRec.normal) / pRayInD.length();
     }
-
-    // determines whether the viewing angle is steep enough for total internal
-    // reflection (zero refraction) and refracts. this math is loosely based on
-    // snells law:   n sin(theta) = n' sin(theta')
-    // common values:  air=1, glass=1.3-1.7, diamond=2.4
-    bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) const
+    else
     {
-        vec3 uv = normalize(v);
-        float dt = dot(uv, n);
-        float discriminant = 1.0f - ni_over_nt*ni_over_nt*(1-dt*dt);
-        if (discriminant > 0) {
-            refracted = ni_over_nt*(uv - n*dt) - n*sqrt(discriminant);
-            return true;
-        }
-        else return false;
+        outward_normal = pRec.normal;
+        ni_over_nt = 1.0f / m.ref_idx;
+        cosine = -dot(pRayInD, pRec.normal) / pRayInD.length();
     }
-
-    vec3 albedo;
-    float ref_idx;
-
-};
+    if (refract(pRayInD, outward_normal, ni_over_nt, refracted))
+    {
+        reflect_prob = schlick(cosine, m.ref_idx);
+    }
+    else reflect_prob = 1.0f;
+    pRayIn = ray(pRec.p, (sampler.next_float() < reflect_prob)? reflected : refracted);
+    isLightSource = false;
+    return true;
+}
 
 
 // Translucent -- Somewhat transparent, tints incoming light
-class Translucent : public Material
+inline Material Translucent(const vec3& a, const float t, const float s)
 {
-public:
-    Translucent(const vec3& a, const float t, const float s) : albedo(a) {
-        translucency = (t>1) + (t>=0 && t<=1)*t;
-        scattering = (scattering>1) + (scattering>=0 && scattering<=1)*scattering;
-        scattering *= 5;
-    }
-
-    static __m128 lerp(__m128 xmm0, __m128 xmm1, float t)
-    {
-        const __m128 t_scalar = _mm_set1_ps(t);
-        const __m128 nt_scalar = _mm_set1_ps(1.0f - t);
-        const __m128 scaled_0 = _mm_mul_ps(xmm0, nt_scalar);
-        return _mm_fmadd_ps(xmm1, t_scalar, scaled_0);
-    }
-
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
-    {
-        pRayIn = ray(pRec.p, pRec.p + pRayIn.direction() + scattering*random_in_unit_sphere());
-        float cosine = (dot(pRayIn.direction(), pRec.normal)) / (pRayIn.direction().length());
-        cosine = 0.5f*(cosine+1.0f);
-        __m128 cosine_xmm = _mm_set1_ps(cosine);
-        __m128 trans_xmm = _mm_set1_ps(translucency);
-        pAttenuation.xmm = _mm_fmadd_ps(albedo.xmm, cosine_xmm, trans_xmm);
-        isLightSource = false;
-        return true;
-    }
+    Material m = {};
+    m.kind = MaterialKind::Translucent;
+    m.albedo = a;
+    m.translucency = (t>1) + (t>=0 && t<=1)*t;
+    m.scattering = (s>1) + (s>=0 && s<=1)*s;
+    m.scattering *= 5;
+    return m;
+}
 
-    vec3 albedo;
-    float translucency;
-    float scattering;
-};
+inline bool scatter_translucent(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    pRayIn = ray(pRec.p, pRec.p + pRayIn.direction() + m.scattering*random_in_unit_sphere(sampler));
+    float cosine = (dot(pRayIn.direction(), pRec.normal)) / (pRayIn.direction().length());
+    cosine = 0.5f*(cosine+1.0f);
+    __m128 cosine_xmm = _mm_set1_ps(cosine);
+    __m128 trans_xmm = _mm_set1_ps(m.translucency);
+#ifdef __FMA__
+    pAttenuation.xmm = _mm_fmadd_ps(m.albedo.xmm, cosine_xmm, trans_xmm);
+#else
+    pAttenuation.xmm = _mm_add_ps(_mm_mul_ps(m.albedo.xmm, cosine_xmm), trans_xmm);
+#endif
+    isLightSource = false;
+    return true;
+}
 
 
 // Normals -- Visualizes normals
-class Normals : public Material
+inline Material Normals()
 {
-public:
-    Normals() {}
+    Material m = {};
+    m.kind = MaterialKind::Normals;
+    return m;
+}
 
-    bool scatter(ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource) const
+inline bool scatter_normals(const Material &, ray &, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &)
+{
+    pAttenuation = pRec.normal;
+    isLightSource = true;
+    return false;
+}
+
+
+// bounces pRayIn off the material, and returns whether to keep tracing it.
+// pAttenuation is what the light gets multiplied by on the way; with
+// isLightSource set, it's light given off instead.
+inline bool scatter(const Material &m, ray &pRayIn, const hit_record &pRec, vec3 &pAttenuation, bool &isLightSource, Sampler &sampler)
+{
+    switch (m.kind)
     {
-        pAttenuation = pRec.normal;
-        isLightSource = true;
-        return false;
+        case MaterialKind::Diffuse:     return scatter_diffuse(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
+        case MaterialKind::Metal:       return scatter_metal(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
+        case MaterialKind::Emmissive:   return scatter_emmissive(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
+        case MaterialKind::Glass:       return scatter_glass(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
+        case MaterialKind::Translucent: return scatter_translucent(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
+        case MaterialKind::Normals:     return scatter_normals(m, pRayIn, pRec, pAttenuation, isLightSource, sampler);
     }
-};
+    return false;
+}
+
+
+// russian roulette. once a path has lost most of its light, whatever it
+// picks up from here on is too dim to matter most of the time, but finding
+// out still costs a full trace per bounce. so it's only kept going with a
+// chance equal to its brightest channel, and made brighter by the same
+// factor when it is, to make up for the ones that aren't. on average the
+// image comes out the same; the paths just end sooner.
+inline bool survives_roulette(vec3 &throughput, Sampler &sampler)
+{
+    const float p = fminf(fmaxf(throughput[0], fmaxf(throughput[1], throughput[2])), 1.0f);
+    if (sampler.next_float() >= p) return false;
+    throughput /= p;
+    return true;
+}
 
 #endif
@@ -0,0 +1,178 @@
+#ifndef RAYPACKETH
+#define RAYPACKETH
+
+#include <cfloat>
+#include <immintrin.h>
+
+#include "vector.h"
+#include "vector_soa.h"
+#include "../ray.h"
+
+// A bundle of PACKET_WIDTH x PACKET_HEIGHT camera rays for neighbouring
+// pixels, traced together. They start at the same point and go in nearly the
+// same direction, so they go through the same boxes and hit the same spheres;
+// tracing them as a group means each node and sphere is fetched once per
+// packet instead of once per ray, and tested against four rays at a time.
+//
+// Everything is stored one array per component. Rays are worked on in
+// groups of four, one per SSE lane.
+
+#define PACKET_SIZE (PACKET_WIDTH * PACKET_HEIGHT)
+#define PACKET_GROUPS (PACKET_SIZE / 4)
+
+struct RayPacket
+{
+    alignas(16) float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    alignas(16) float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    alignas(16) float ix[PACKET_SIZE], iy[PACKET_SIZE], iz[PACKET_SIZE];   // 1/direction
+    alignas(16) float tMax[PACKET_SIZE];   // closest hit so far
+
+    inline void set(int i, const ray &r);
+    // ray i is left out: nothing can hit it
+    inline void disable(int i);
+    inline ray get(int i) const { return ray(vec3(ox[i], oy[i], oz[i]), vec3(dx[i], dy[i], dz[i])); }
+    inline bool active(int i) const { return tMax[i] >= 0; }
+
+    inline vec3x4 origin(int g) const { return vec3x4::load(ox + 4*g, oy + 4*g, oz + 4*g); }
+    inline vec3x4 direction(int g) const { return vec3x4::load(dx + 4*g, dy + 4*g, dz + 4*g); }
+    inline vec3x4 invDirection(int g) const { return vec3x4::load(ix + 4*g, iy + 4*g, iz + 4*g); }
+};
+
+inline void RayPacket::set(int i, const ray &r)
+{
+    const vec3 o = r.origin(), d = r.direction();
+    ox[i] = o.x(); oy[i] = o.y(); oz[i] = o.z();
+    dx[i] = d.x(); dy[i] = d.y(); dz[i] = d.z();
+    ix[i] = 1.0f / d.x(); iy[i] = 1.0f / d.y(); iz[i] = 1.0f / d.z();
+    tMax[i] = FLT_MAX;
+}
+
+inline void RayPacket::disable(int i)
+{
+    set(i, ray(vec3(0,0,0), vec3(1,1,1)));
+    tMax[i] = -FLT_MAX;
+}
+
+// slab test of group g's four rays against one box; returns a bitmask of the
+// rays that go through it closer than their closest hit so far
+inline int packet_group_hits_box(const RayPacket &p, int g, const float *bmin, const float *bmax, float tMin)
+{
+    const vec3x4 o = p.origin(g), inv = p.invDirection(g);
+    const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[0]), o.x), inv.x);
+    const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[0]), o.x), inv.x);
+    const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[1]), o.y), inv.y);
+    const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[1]), o.y), inv.y);
+    const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[2]), o.z), inv.z);
+    const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[2]), o.z), inv.z);
+    const __m128 tn = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                 _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tMin)));
+    const __m128 tf = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                 _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(p.tMax + 4*g)));
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+}
+
+// the range of a packet's origins and of its 1/directions, on each axis.
+// only of any use (coherent) if, on every axis, the rays all go the same way.
+struct PacketBounds
+{
+    __m128 oLo, oHi, iLo, iHi;
+    bool coherent;
+};
+
+inline PacketBounds packet_bounds(const RayPacket &p)
+{
+    PacketBounds b;
+    b.oLo = b.iLo = _mm_set1_ps(FLT_MAX);
+    b.oHi = b.iHi = _mm_set1_ps(-FLT_MAX);
+    for (int i = 0; i < PACKET_SIZE; i++)
+    {
+        if (!p.active(i)) continue;
+        const __m128 o = _mm_setr_ps(p.ox[i], p.oy[i], p.oz[i], 0);
+        const __m128 inv = _mm_setr_ps(p.ix[i], p.iy[i], p.iz[i], 1);
+        b.oLo = _mm_min_ps(b.oLo, o); b.oHi = _mm_max_ps(b.oHi, o);
+        b.iLo = _mm_min_ps(b.iLo, inv); b.iHi = _mm_max_ps(b.iHi, inv);
+    }
+    // no sign changes, and nothing infinite (which would make 0 * inf below)
+    const __m128 limit = _mm_set1_ps(FLT_MAX);
+    const __m128 same = _mm_or_ps(_mm_cmpgt_ps(b.iLo, _mm_setzero_ps()), _mm_cmplt_ps(b.iHi, _mm_setzero_ps()));
+    const __m128 finite = _mm_and_ps(_mm_cmpge_ps(b.iLo, _mm_sub_ps(_mm_setzero_ps(), limit)), _mm_cmple_ps(b.iHi, limit));
+    b.coherent = _mm_movemask_ps(_mm_and_ps(same, finite)) == 0xF;
+    return b;
+}
+
+// interval arithmetic on the packet's bounds: is the box definitely missed by
+// every ray in it? on each axis, the earliest any ray could cross the near
+// plane and the latest any could cross the far plane are worked out; if the
+// latest of the former is past the earliest of the latter, nothing gets
+// through. bmin and bmax are read as four floats each; the fourth is
+// cleared straight away (in a BVHNode it's an index, which as a float is a
+// denormal, and those are very slow to do sums with).
+inline bool packet_misses_box(const PacketBounds &b, const float *bmin, const float *bmax, float tMin)
+{
+    if (!b.coherent) return false;
+    const __m128 lo = _mm_blend_ps(_mm_loadu_ps(bmin), _mm_setzero_ps(), 0x8);
+    const __m128 hi = _mm_blend_ps(_mm_loadu_ps(bmax), _mm_setzero_ps(), 0x8);
+    const __m128 positive = _mm_cmpgt_ps(b.iLo, _mm_setzero_ps());
+    const __m128 nearPlane = _mm_blendv_ps(hi, lo, positive);
+    const __m128 farPlane = _mm_blendv_ps(lo, hi, positive);
+
+    const __m128 n0 = _mm_sub_ps(nearPlane, b.oHi), n1 = _mm_sub_ps(nearPlane, b.oLo);
+    const __m128 f0 = _mm_sub_ps(farPlane, b.oHi), f1 = _mm_sub_ps(farPlane, b.oLo);
+    __m128 tNear = _mm_min_ps(_mm_min_ps(_mm_mul_ps(n0, b.iLo), _mm_mul_ps(n0, b.iHi)),
+                              _mm_min_ps(_mm_mul_ps(n1, b.iLo), _mm_mul_ps(n1, b.iHi)));
+    __m128 tFar  = _mm_max_ps(_mm_max_ps(_mm_mul_ps(f0, b.iLo), _mm_mul_ps(f0, b.iHi)),
+                              _mm_max_ps(_mm_mul_ps(f1, b.iLo), _mm_mul_ps(f1, b.iHi)));
+    // fourth lane: tMin, and no limit
+    tNear = _mm_blend_ps(tNear, _mm_set1_ps(tMin), 0x8);
+    tFar  = _mm_blend_ps(tFar, _mm_set1_ps(FLT_MAX), 0x8);
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2,3,0,1)));
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1,0,3,2)));
+    return _mm_comigt_ss(tNear, hmin(tFar));
+}
+
+// does any ray in the packet go through the box? for coherent rays the first
+// group nearly always settles it when it's a hit, and the bounds when it's
+// a miss.
+inline bool packet_hits_box(const RayPacket &p, const PacketBounds &bounds,
+                            const float *bmin, const float *bmax, float tMin)
+{
+    if (packet_group_hits_box(p, 0, bmin, bmax, tMin)) return true;
+    if (packet_misses_box(bounds, bmin, bmax, tMin)) return false;
+    for (int g = 1; g < PACKET_GROUPS; g++)
+        if (packet_group_hits_box(p, g, bmin, bmax, tMin)) return true;
+    return false;
+}
+
+// group g's four rays against one sphere, same quadratic as Sphere::closest_t.
+// returns a bitmask of the rays that might hit it closer than their closest
+// hit so far; those get confirmed with Sphere::closest_t itself. the test here
+// is a little generous on purpose, so rounding can only make it let through
+// something closest_t then turns down, never miss something it would have
+// found. that way a packet finds exactly the same hits as single rays do.
+inline int packet_group_hit_sphere(const RayPacket &p, int g, const vec3 &center, float radiusSq, float tMin)
+{
+    const __m128 slack = _mm_set1_ps(1e-4f);
+    const vec3x4 oc = p.origin(g) - vec3x4(center);
+    const vec3x4 d = p.direction(g);
+    const __m128 a = dot(d, d);
+    const __m128 b = dot(oc, d);
+    const __m128 c = _mm_sub_ps(dot(oc, oc), _mm_set1_ps(radiusSq));
+    const __m128 bb = _mm_mul_ps(b, b);
+    const __m128 discrim = _mm_sub_ps(bb, _mm_mul_ps(a, c));
+    const __m128 hasRoots = _mm_cmpgt_ps(discrim, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(bb, slack)));
+    if (!_mm_movemask_ps(hasRoots)) return 0;
+
+    // it's a hit if the part of the ray inside the sphere, [tMinus,tPlus],
+    // overlaps (tMin,tMax) at all
+    const __m128 sq = _mm_sqrt_ps(_mm_max_ps(discrim, _mm_setzero_ps()));
+    const __m128 nb = _mm_sub_ps(_mm_setzero_ps(), b);
+    const __m128 tMinus = _mm_div_ps(_mm_sub_ps(nb, sq), a);
+    const __m128 tPlus  = _mm_div_ps(_mm_add_ps(nb, sq), a);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 tMaxLoose = _mm_mul_ps(_mm_load_ps(p.tMax + 4*g), _mm_add_ps(one, slack));
+    const __m128 tMinLoose = _mm_mul_ps(_mm_set1_ps(tMin), _mm_sub_ps(one, slack));
+    const __m128 hit = _mm_and_ps(hasRoots, _mm_and_ps(_mm_cmplt_ps(tMinus, tMaxLoose), _mm_cmpgt_ps(tPlus, tMinLoose)));
+    return _mm_movemask_ps(hit);
+}
+
+#endif
@@ -2,23 +2,33 @@
 #define SPHEREH
 
 #include "vector.h"
-#include "ray.h"
-#include "hitable.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
 #include "material.h"
 
 class Sphere: public Hitable
 {
 public:
     Sphere() {};
-    Sphere(vec3 cen, float r, Material* mat) : center(cen), radius(r), pMat(mat) { radiusSq = radius*radius; };
-    bool hit(const ray & r, float t_min, float t_max, hit_record & rec) const override;
+    Sphere(vec3 cen, float r, uint32_t mat) : center(cen), radius(r), matId(mat) { radiusSq = radius*radius; };
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+    void intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const override;
+
+    // the two halves of hit() without the virtual call, for things that keep
+    // their own arrays of spheres: the closest t in (tMin,tMax), and the
+    // hit_record for the hit at t
+    inline bool closest_t(const ray &rayIn, float tMin, float tMax, float &t) const;
+    inline void fill(const ray &rayIn, float t, hit_record &rec) const;
 
     vec3 center;
     float radius, radiusSq;
-    Material* pMat;
+    uint32_t matId;
 };
 
-bool Sphere::hit(const ray &rayIn, float tMin, float tMax, hit_record &rec) const
+inline bool Sphere::closest_t(const ray &rayIn, float tMin, float tMax, float &t) const
 {
     vec3 oc = rayIn.origin() - center;
     // find quadratic roots
@@ -32,24 +42,60 @@ bool Sphere::hit(const ray &rayIn, float tMin, float tMax, hit_record &rec) cons
         float temp = (-b - sqrt(discrim)) / a;
         if (temp < tMax && temp > tMin)
         {
-            rec.t = temp;
-            rec.p = rayIn.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.pMat = pMat;
+            t = temp;
             return true;
         }
         // try "plus" quadratic root
         temp = (-b + sqrt(discrim)) / a;
         if (temp < tMax && temp > tMin)
         {
-            rec.t = temp;
-            rec.p = rayIn.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.pMat = pMat;
+            t = temp;
             return true;
         }
     }
     return false;
 }
 
+inline void Sphere::fill(const ray &rayIn, float t, hit_record &rec) const
+{
+    rec.t = t;
+    rec.p = rayIn.point_at_parameter(t);
+    rec.normal = (rec.p - center) / radius;
+    rec.matId = matId;
+}
+
+bool Sphere::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    if (!closest_t(rayIn, tMin, tMax, info.t)) return false;
+    info.prim = 0;
+    info.pObj = this;
+    return true;
+}
+
+void Sphere::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    fill(rayIn, info.t, rec);
+}
+
+bool Sphere::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    float t;
+    return closest_t(rayIn, tMin, tMax, t);
+}
+
+void Sphere::intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const
+{
+    for (int g = 0; g < PACKET_GROUPS; g++)
+    {
+        int mask = packet_group_hit_sphere(packet, g, center, radiusSq, tMin);
+        while (mask)
+        {
+            const int i = 4*g + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (intersect(packet.get(i), tMin, packet.tMax[i], pInfos[i]))
+                packet.tMax[i] = pInfos[i].t;
+        }
+    }
+}
+
 #endif
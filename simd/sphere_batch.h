@@ -0,0 +1,340 @@
+#ifndef SPHEREBATCHH
+#define SPHEREBATCHH
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+#include "vector.h"
+#include "vector_soa.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "sphere.h"
+
+// A whole pile of spheres behind one Hitable. Instead of a list of pointers
+// to separate Sphere objects (and a virtual call for each), the centers and
+// radii are kept in contiguous arrays, one per component, and intersect()
+// tests one ray against 16 (AVX-512), 8 (AVX) or 4 (SSE) spheres per
+// iteration. Each lane keeps its own closest t and sphere index; a min
+// reduction at the end picks the winner.
+//
+// The spheres can also be kept in groups, each starting on a whole register,
+// and tested a group at a time with closest() and any(). That's what the
+// BVHs do with their leaves: one leaf is one group, so it takes one pass (or
+// two, for SSE) however many spheres are in it.
+
+// spheres per pass. the arrays are padded to a multiple of this, so every
+// pass works on whole registers; padding spheres have radiusSq = -inf and
+// can never be hit.
+#if defined(__AVX512F__)
+    #define SPHERE_BATCH_WIDTH 16
+#elif defined(__AVX__)
+    #define SPHERE_BATCH_WIDTH 8
+#else
+    #define SPHERE_BATCH_WIDTH 4
+#endif
+
+class SphereBatch : public Hitable
+{
+public:
+    SphereBatch() {}
+    SphereBatch(Sphere **list, int n) { for (int i = 0; i < n; i++) add(*list[i]); }
+
+    void add(const vec3 &center, float radius, uint32_t matId);
+    void add(const Sphere &s) { add(s.center, s.radius, s.matId); }
+    // room for a group of count spheres, starting on a whole register, to be
+    // filled in with set(). returns the group's first slot.
+    uint32_t addGroup(uint32_t count);
+    void set(uint32_t slot, const Sphere &s);
+    // spheres, not counting the padding
+    int size() const { return m_count; }
+
+    vec3 center(uint32_t slot) const { return vec3(m_cx[slot], m_cy[slot], m_cz[slot]); }
+    float radiusSq(uint32_t slot) const { return m_radiusSq[slot]; }
+
+    // the closest hit in (tMin,tMax) among the count slots from first, which
+    // has to be where a group starts. returns its slot and puts its distance
+    // in t, or returns -1 (leaving t alone) if there's nothing there.
+    inline int closest(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &t) const;
+    // whether any of them is hit in (tMin,tMax)
+    inline bool any(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax) const;
+    // the hit_record for slot's sphere hit at t
+    inline void fill(const ray &rayIn, uint32_t slot, float t, hit_record &rec) const;
+
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+
+private:
+    // each returns the slot of the closest sphere (or -1) and its t. with
+    // ANY_HIT, they give up looking for the closest and return first (leaving
+    // tOut alone) as soon as any sphere is hit.
+    template<bool ANY_HIT> int m_closest16(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const;
+    template<bool ANY_HIT> int m_closest8(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const;
+    template<bool ANY_HIT> int m_closest4(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const;
+    template<bool ANY_HIT> int m_closestN(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const;
+    // pads the arrays out past the last slot in use
+    void m_pad();
+
+    int m_count = 0;
+    uint32_t m_used = 0;      // slots, up to the end of the last sphere
+    std::vector<float> m_cx, m_cy, m_cz;
+    std::vector<float> m_radius, m_radiusSq;
+    std::vector<uint32_t> m_matIds;
+};
+
+void SphereBatch::m_pad()
+{
+    const uint32_t padded = (m_used + SPHERE_BATCH_WIDTH - 1) / SPHERE_BATCH_WIDTH * SPHERE_BATCH_WIDTH;
+    m_cx.resize(padded, 0.0f); m_cy.resize(padded, 0.0f); m_cz.resize(padded, 0.0f);
+    m_radius.resize(padded, 1.0f);
+    m_radiusSq.resize(padded, -INFINITY);
+    m_matIds.resize(padded, 0);
+}
+
+void SphereBatch::add(const vec3 &center, float radius, uint32_t matId)
+{
+    // the next slot is padding, or past the end
+    m_used++;
+    m_count++;
+    m_pad();
+    set(m_used - 1, Sphere(center, radius, matId));
+}
+
+uint32_t SphereBatch::addGroup(uint32_t count)
+{
+    const uint32_t first = (m_used + SPHERE_BATCH_WIDTH - 1) / SPHERE_BATCH_WIDTH * SPHERE_BATCH_WIDTH;
+    m_used = first + count;
+    m_count += count;
+    m_pad();
+    return first;
+}
+
+void SphereBatch::set(uint32_t slot, const Sphere &s)
+{
+    m_cx[slot] = s.center.x();
+    m_cy[slot] = s.center.y();
+    m_cz[slot] = s.center.z();
+    m_radius[slot] = s.radius;
+    m_radiusSq[slot] = s.radius*s.radius;
+    m_matIds[slot] = s.matId;
+}
+
+template<bool ANY_HIT>
+inline int SphereBatch::m_closestN(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const
+{
+#if defined(__AVX512F__)
+    return m_closest16<ANY_HIT>(rayIn, first, count, tMin, tMax, tOut);
+#elif defined(__AVX__)
+    return m_closest8<ANY_HIT>(rayIn, first, count, tMin, tMax, tOut);
+#else
+    return m_closest4<ANY_HIT>(rayIn, first, count, tMin, tMax, tOut);
+#endif
+}
+
+inline int SphereBatch::closest(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &t) const
+{
+    return m_closestN<false>(rayIn, first, count, tMin, tMax, t);
+}
+
+inline bool SphereBatch::any(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax) const
+{
+    float t;
+    return m_closestN<true>(rayIn, first, count, tMin, tMax, t) >= 0;
+}
+
+inline void SphereBatch::fill(const ray &rayIn, uint32_t slot, float t, hit_record &rec) const
+{
+    rec.t = t;
+    rec.p = rayIn.point_at_parameter(t);
+    rec.normal = (rec.p - center(slot)) / m_radius[slot];
+    rec.matId = m_matIds[slot];
+}
+
+bool SphereBatch::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    float t;
+    const int i = closest(rayIn, 0, m_used, tMin, tMax, t);
+    if (i < 0) return false;
+    info = { t, uint32_t(i), this };
+    return true;
+}
+
+bool SphereBatch::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    return any(rayIn, 0, m_used, tMin, tMax);
+}
+
+void SphereBatch::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    fill(rayIn, info.prim, info.t, rec);
+}
+
+// the three kernels below are the same quadratic as Sphere::closest_t, with
+// one sphere per lane. the lanes' sphere numbers are kept as floats, counting
+// from first, so they can be blended along with the distances.
+
+#ifdef __AVX512F__
+template<bool ANY_HIT>
+int SphereBatch::m_closest16(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const
+{
+    const vec3 o = rayIn.origin();
+    const vec3 d = rayIn.direction();
+    const __m512 ox = _mm512_set1_ps(o.x()), oy = _mm512_set1_ps(o.y()), oz = _mm512_set1_ps(o.z());
+    const __m512 dx = _mm512_set1_ps(d.x()), dy = _mm512_set1_ps(d.y()), dz = _mm512_set1_ps(d.z());
+    const float a = d.squared_length();
+    const __m512 a16 = _mm512_set1_ps(a);
+    const __m512 inv_a = _mm512_set1_ps(1.0f / a);
+    const __m512 tMin16 = _mm512_set1_ps(tMin);
+    const __m512 zero = _mm512_setzero_ps();
+
+    __m512 best = _mm512_set1_ps(tMax);
+    __m512 bestIndex = _mm512_set1_ps(-1.0f);
+    __m512 index = _mm512_setr_ps(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+    const __m512 step = _mm512_set1_ps(16.0f);
+
+    for (uint32_t i = first; i < first + count; i += 16, index = _mm512_add_ps(index, step))
+    {
+        const __m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&m_cx[i]));
+        const __m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&m_cy[i]));
+        const __m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&m_cz[i]));
+        const __m512 b = _mm512_fmadd_ps(ocz, dz, _mm512_fmadd_ps(ocy, dy, _mm512_mul_ps(ocx, dx)));
+        const __m512 c = _mm512_sub_ps(
+            _mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_mul_ps(ocx, ocx))),
+            _mm512_loadu_ps(&m_radiusSq[i]));
+        const __m512 discrim = _mm512_fmsub_ps(b, b, _mm512_mul_ps(a16, c));
+        const __mmask16 any = _mm512_cmp_ps_mask(discrim, zero, _CMP_GT_OQ);
+        if (!any) continue;
+
+        // (the maskz_ forms here and below, with every lane on, are the same
+        // instructions; gcc 12's plain ones trip -Wuninitialized in its own
+        // headers)
+        const __m512 sq = _mm512_maskz_sqrt_ps(0xFFFF, _mm512_maskz_max_ps(0xFFFF, discrim, zero));
+        const __m512 nb = _mm512_sub_ps(zero, b);
+        const __m512 t0 = _mm512_mul_ps(_mm512_sub_ps(nb, sq), inv_a);
+        const __m512 t1 = _mm512_mul_ps(_mm512_add_ps(nb, sq), inv_a);
+        // "minus" root if it's in range, otherwise "plus" root
+        const __mmask16 ok0 = _mm512_cmp_ps_mask(t0, tMin16, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t0, best, _CMP_LT_OQ);
+        const __m512 t = _mm512_mask_blend_ps(ok0, t1, t0);
+        const __mmask16 ok = any & _mm512_cmp_ps_mask(t, tMin16, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, best, _CMP_LT_OQ);
+        if (ANY_HIT && ok) return first;
+        best = _mm512_mask_blend_ps(ok, best, t);
+        bestIndex = _mm512_mask_blend_ps(ok, bestIndex, index);
+    }
+
+    // halve it, then the 8-wide horizontal min
+    const __m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(best), 0));
+    const __m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(best), 1));
+    const float closest = _mm256_cvtss_f32(hmin(_mm256_min_ps(lo, hi)));
+    const __mmask16 which = _mm512_cmp_ps_mask(best, _mm512_set1_ps(closest), _CMP_EQ_OQ);
+    alignas(64) float indices[16];
+    _mm512_store_ps(indices, bestIndex);
+    const float index0 = indices[__builtin_ctz(which)];
+    if (index0 < 0) return -1;
+    tOut = closest;
+    return first + int(index0);
+}
+#endif
+
+#ifdef __AVX__
+template<bool ANY_HIT>
+int SphereBatch::m_closest8(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const
+{
+    const vec3x8 o(rayIn.origin());
+    const vec3x8 d(rayIn.direction());
+    const float a = rayIn.direction().squared_length();
+    const __m256 a8 = _mm256_set1_ps(a);
+    const __m256 inv_a = _mm256_set1_ps(1.0f / a);
+    const __m256 tMin8 = _mm256_set1_ps(tMin);
+    const __m256 zero = _mm256_setzero_ps();
+
+    __m256 best = _mm256_set1_ps(tMax);
+    __m256 bestIndex = _mm256_set1_ps(-1.0f);
+    __m256 index = _mm256_setr_ps(0,1,2,3,4,5,6,7);
+    const __m256 step = _mm256_set1_ps(8.0f);
+
+    for (uint32_t i = first; i < first + count; i += 8, index = _mm256_add_ps(index, step))
+    {
+        const vec3x8 oc = o - vec3x8::load(&m_cx[i], &m_cy[i], &m_cz[i]);
+        const __m256 b = dot(oc, d);
+        const __m256 c = _mm256_sub_ps(oc.squared_length(), _mm256_loadu_ps(&m_radiusSq[i]));
+        const __m256 discrim = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(a8, c));
+        const __m256 any = _mm256_cmp_ps(discrim, zero, _CMP_GT_OQ);
+        if (!_mm256_movemask_ps(any)) continue;
+
+        const __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(discrim, zero));
+        const __m256 nb = _mm256_sub_ps(zero, b);
+        const __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(nb, sq), inv_a);
+        const __m256 t1 = _mm256_mul_ps(_mm256_add_ps(nb, sq), inv_a);
+        // "minus" root if it's in range, otherwise "plus" root
+        const __m256 ok0 = _mm256_and_ps(_mm256_cmp_ps(t0, tMin8, _CMP_GT_OQ), _mm256_cmp_ps(t0, best, _CMP_LT_OQ));
+        const __m256 t = _mm256_blendv_ps(t1, t0, ok0);
+        const __m256 ok = _mm256_and_ps(any,
+            _mm256_and_ps(_mm256_cmp_ps(t, tMin8, _CMP_GT_OQ), _mm256_cmp_ps(t, best, _CMP_LT_OQ)));
+        if (ANY_HIT && _mm256_movemask_ps(ok)) return first;
+        best = _mm256_blendv_ps(best, t, ok);
+        bestIndex = _mm256_blendv_ps(bestIndex, index, ok);
+    }
+
+    const __m256 closest = hmin(best);
+    const int which = _mm256_movemask_ps(_mm256_cmp_ps(best, closest, _CMP_EQ_OQ));
+    alignas(32) float indices[8];
+    _mm256_store_ps(indices, bestIndex);
+    const float index0 = indices[__builtin_ctz(which)];
+    if (index0 < 0) return -1;
+    tOut = _mm256_cvtss_f32(closest);
+    return first + int(index0);
+}
+#endif
+
+template<bool ANY_HIT>
+int SphereBatch::m_closest4(const ray &rayIn, uint32_t first, uint32_t count, float tMin, float tMax, float &tOut) const
+{
+    const vec3x4 o(rayIn.origin());
+    const vec3x4 d(rayIn.direction());
+    const float a = rayIn.direction().squared_length();
+    const __m128 a4 = _mm_set1_ps(a);
+    const __m128 inv_a = _mm_set1_ps(1.0f / a);
+    const __m128 tMin4 = _mm_set1_ps(tMin);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 best = _mm_set1_ps(tMax);
+    __m128 bestIndex = _mm_set1_ps(-1.0f);
+    __m128 index = _mm_setr_ps(0,1,2,3);
+    const __m128 step = _mm_set1_ps(4.0f);
+
+    for (uint32_t i = first; i < first + count; i += 4, index = _mm_add_ps(index, step))
+    {
+        const vec3x4 oc = o - vec3x4::load(&m_cx[i], &m_cy[i], &m_cz[i]);
+        const __m128 b = dot(oc, d);
+        const __m128 c = _mm_sub_ps(oc.squared_length(), _mm_loadu_ps(&m_radiusSq[i]));
+        const __m128 discrim = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a4, c));
+        const __m128 any = _mm_cmpgt_ps(discrim, zero);
+        if (!_mm_movemask_ps(any)) continue;
+
+        const __m128 sq = _mm_sqrt_ps(_mm_max_ps(discrim, zero));
+        const __m128 nb = _mm_sub_ps(zero, b);
+        const __m128 t0 = _mm_mul_ps(_mm_sub_ps(nb, sq), inv_a);
+        const __m128 t1 = _mm_mul_ps(_mm_add_ps(nb, sq), inv_a);
+        // "minus" root if it's in range, otherwise "plus" root
+        const __m128 ok0 = _mm_and_ps(_mm_cmpgt_ps(t0, tMin4), _mm_cmplt_ps(t0, best));
+        const __m128 t = _mm_blendv_ps(t1, t0, ok0);
+        const __m128 ok = _mm_and_ps(any, _mm_and_ps(_mm_cmpgt_ps(t, tMin4), _mm_cmplt_ps(t, best)));
+        if (ANY_HIT && _mm_movemask_ps(ok)) return first;
+        best = _mm_blendv_ps(best, t, ok);
+        bestIndex = _mm_blendv_ps(bestIndex, index, ok);
+    }
+
+    const __m128 closest = hmin(best);
+    const int which = _mm_movemask_ps(_mm_cmpeq_ps(best, closest));
+    alignas(16) float indices[4];
+    _mm_store_ps(indices, bestIndex);
+    const float index0 = indices[__builtin_ctz(which)];
+    if (index0 < 0) return -1;
+    tOut = _mm_cvtss_f32(closest);
+    return first + int(index0);
+}
+
+#endif
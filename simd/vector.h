@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <iostream>
 
+#include "../sampler.h"
+
 #ifndef VEC3_EQUALS_EPSILON
 #define VEC3_EQUALS_EPSILON 1.0e-9
 #endif
@@ -14,7 +16,9 @@ class vec3
 {
 public:
     vec3() { xmm = _mm_set1_ps(0.0f); }
-    vec3(float v0, float v1, float v2) { v[0] = v0; v[1] = v1; v[2] = v2; }
+    // the fourth lane is zeroed, not left as whatever was in the register: if
+    // that happens to be a denormal, everything done with the vector is slow
+    vec3(float v0, float v1, float v2) { xmm = _mm_setr_ps(v0, v1, v2, 0.0f); }
     vec3(__m128 xmm) { this->xmm = xmm; }
 
     inline float x() const { return v[0]; }
@@ -211,7 +215,7 @@ inline vec3 cross(const vec3& v1, const vec3& v2)
 {
     const __m128 tmp0 = _mm_shuffle_ps(v1.xmm, v1.xmm, _MM_SHUFFLE(3,0,2,1));
           __m128 tmp1 = _mm_shuffle_ps(v2.xmm, v2.xmm, _MM_SHUFFLE(3,1,0,2));
-          __m128 tmp2 = _mm_mul_ps(tmp0, v1.xmm);
+          __m128 tmp2 = _mm_mul_ps(tmp0, v2.xmm);
                  tmp1 = _mm_mul_ps(tmp0, tmp1);
                  tmp2 = _mm_shuffle_ps(tmp2, tmp2, _MM_SHUFFLE(3,0,2,1));
     return vec3(_mm_sub_ps(tmp1,tmp2));
@@ -225,18 +229,154 @@ inline vec3 normalize(vec3 v)
     return vec3(_mm_mul_ps(v.xmm, s));
 }
 
-inline vec3 random_in_unit_sphere()
+// sine and cosine of four angles in [0, 2pi) at once, with no calls out to
+// libm. cephes' sinf/cosf, the same way as Julien Pommier's sse_mathfun:
+// the angle is brought to within pi/4 of the nearest multiple of pi/2,
+// which of the four that is says whether sine and cosine swap over and which
+// of them flip sign, and a short polynomial does the rest (to within a
+// couple of ulps). all done on floats, so vector_soa.h's eight-wide version
+// can go the very same way with plain AVX.
+inline void sincos_ps(__m128 x, __m128 &s, __m128 &c)
+{
+    // q is the multiple of pi/2, and r which quarter of the circle that is
+    const __m128 q = _mm_floor_ps(_mm_mul_ps(_mm_add_ps(_mm_floor_ps(_mm_mul_ps(x, _mm_set1_ps(float(4.0 / M_PI)))), _mm_set1_ps(1.0f)), _mm_set1_ps(0.5f)));
+    const __m128 r = _mm_sub_ps(q, _mm_mul_ps(_mm_floor_ps(_mm_mul_ps(q, _mm_set1_ps(0.25f))), _mm_set1_ps(4.0f)));
+    // x - q*pi/2, with pi/2 in three parts so nothing is lost
+    const __m128 y = _mm_add_ps(q, q);
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+    const __m128 z = _mm_mul_ps(x, x);
+
+    __m128 cp = _mm_set1_ps(2.443315711809948e-5f);
+    cp = _mm_add_ps(_mm_mul_ps(cp, z), _mm_set1_ps(-1.388731625493765e-3f));
+    cp = _mm_add_ps(_mm_mul_ps(cp, z), _mm_set1_ps(4.166664568298827e-2f));
+    cp = _mm_mul_ps(_mm_mul_ps(cp, z), z);
+    cp = _mm_add_ps(_mm_sub_ps(cp, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+    __m128 sp = _mm_set1_ps(-1.9515295891e-4f);
+    sp = _mm_add_ps(_mm_mul_ps(sp, z), _mm_set1_ps(8.3321608736e-3f));
+    sp = _mm_add_ps(_mm_mul_ps(sp, z), _mm_set1_ps(-1.6666654611e-1f));
+    sp = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sp, z), x), x);
+
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+    const __m128 swap = _mm_or_ps(_mm_cmpeq_ps(r, one), _mm_cmpeq_ps(r, three));
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 sinSign = _mm_and_ps(_mm_cmpge_ps(r, two), sign);
+    const __m128 cosSign = _mm_and_ps(_mm_or_ps(_mm_cmpeq_ps(r, one), _mm_cmpeq_ps(r, two)), sign);
+    s = _mm_xor_ps(_mm_blendv_ps(sp, cp, swap), sinSign);
+    c = _mm_xor_ps(_mm_blendv_ps(cp, sp, swap), cosSign);
+}
+
+// cube roots of four numbers in [0,1). a guess from halving the exponent...
+// well, thirding it, by treating the float's bits as an integer; then
+// Newton's method twice, which leaves it good to a couple of parts in a
+// million.
+inline __m128 cbrt_ps(__m128 w)
+{
+    const __m128 bits = _mm_cvtepi32_ps(_mm_castps_si128(w));
+    __m128 r = _mm_castsi128_ps(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(bits, _mm_set1_ps(1.0f / 3.0f)), _mm_set1_ps(709921077.0f))));
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    r = _mm_mul_ps(_mm_add_ps(_mm_add_ps(r, r), _mm_div_ps(w, _mm_mul_ps(r, r))), third);
+    r = _mm_mul_ps(_mm_add_ps(_mm_add_ps(r, r), _mm_div_ps(w, _mm_mul_ps(r, r))), third);
+    return r;
+}
+
+// the sampling below, four at a time and without a single branch: u and v
+// (and w) in [0,1) become points on, or in, the unit sphere. vector_soa.h
+// wraps these up as vec3x4's, and has eight-wide ones; the one-at-a-time
+// versions just use the first lane, so a direction comes out exactly the
+// same whichever of them made it.
+
+// on the unit sphere: the height is uniform, and so is the angle around
+inline void uniform_sphere_ps(__m128 u, __m128 v, __m128 &x, __m128 &y, __m128 &z)
+{
+    z = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps(2.0f)), _mm_set1_ps(1.0f));
+    const __m128 r = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(z, z))));
+    __m128 s, c;
+    sincos_ps(_mm_mul_ps(v, _mm_set1_ps(2.0f * float(M_PI))), s, c);
+    x = _mm_mul_ps(r, c);
+    y = _mm_mul_ps(r, s);
+}
+
+// in the unit sphere: a direction, then how far out, with the cube root
+// giving each shell its share by volume
+inline void uniform_ball_ps(__m128 u, __m128 v, __m128 w, __m128 &x, __m128 &y, __m128 &z)
+{
+    uniform_sphere_ps(u, v, x, y, z);
+    const __m128 r = cbrt_ps(w);
+    x = _mm_mul_ps(x, r); y = _mm_mul_ps(y, r); z = _mm_mul_ps(z, r);
+}
+
+// cosine-weighted about the normal (nx, ny, nz), which is what a Lambertian
+// surface reflects: the normal plus a point on the unit sphere. the one
+// point that cancels the normal out gives back the normal instead. (the add
+// is done here, lane by lane, rather than on a vec3 afterwards, so that the
+// compiler fuses the same multiplies and adds into FMAs in every version)
+inline void cosine_hemisphere_ps(__m128 nx, __m128 ny, __m128 nz, __m128 u, __m128 v, __m128 &x, __m128 &y, __m128 &z)
+{
+    uniform_sphere_ps(u, v, x, y, z);
+    x = _mm_add_ps(nx, x); y = _mm_add_ps(ny, y); z = _mm_add_ps(nz, z);
+    __m128 l2 = _mm_mul_ps(x, x);
+    l2 = _mm_add_ps(l2, _mm_mul_ps(y, y));
+    l2 = _mm_add_ps(l2, _mm_mul_ps(z, z));
+    const __m128 degenerate = _mm_cmplt_ps(l2, _mm_set1_ps(1e-8f));
+    x = _mm_blendv_ps(x, nx, degenerate); y = _mm_blendv_ps(y, ny, degenerate); z = _mm_blendv_ps(z, nz, degenerate);
+}
+
+// the vector made of lane 0 of x, y and z, with its fourth lane zeroed,
+// without going through memory
+inline vec3 from_lane0(__m128 x, __m128 y, __m128 z)
+{
+    return vec3(_mm_movelh_ps(_mm_unpacklo_ps(x, y), _mm_unpacklo_ps(z, _mm_setzero_ps())));
+}
+
+// one at a time
+inline vec3 uniform_sphere(float u, float v)
+{
+    __m128 x, y, z;
+    uniform_sphere_ps(_mm_set1_ps(u), _mm_set1_ps(v), x, y, z);
+    return from_lane0(x, y, z);
+}
+
+inline vec3 uniform_ball(float u, float v, float w)
+{
+    __m128 x, y, z;
+    uniform_ball_ps(_mm_set1_ps(u), _mm_set1_ps(v), _mm_set1_ps(w), x, y, z);
+    return from_lane0(x, y, z);
+}
+
+inline vec3 cosine_hemisphere(const vec3 &normal, float u, float v)
+{
+    __m128 x, y, z;
+    cosine_hemisphere_ps(_mm_set1_ps(normal[0]), _mm_set1_ps(normal[1]), _mm_set1_ps(normal[2]),
+                         _mm_set1_ps(u), _mm_set1_ps(v), x, y, z);
+    return from_lane0(x, y, z);
+}
+
+// the same, with the numbers from a sampler. u and v are taken as a pair, so
+// the sampler can spread them out over the sphere evenly. there's no
+// rejection loop anywhere: throwing numbers away would leave the sampler's
+// later ones out of step, and costs a branch that goes either way about
+// half the time.
+inline vec3 random_unit_vector(Sampler &sampler)
 {
-    float x,y,z,sqsum;
-    do {
-        // pick random point in unit cube -- 2x-1 ; scales [0,1] to [-1,1]
-        x = 2.0f * drand48() - 1.0f;
-        y = 2.0f * drand48() - 1.0f;
-        z = 2.0f * drand48() - 1.0f;
-        sqsum = x*x; sqsum += y*y; sqsum += z*z;
-    // reject while not in unit sphere; this happens when : sqrt(x^2 + y^2 + z^2) > 1
-    } while (sqsum > 1);
-    return vec3(x,y,z);
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return uniform_sphere(u, v);
+}
+
+inline vec3 random_in_unit_sphere(Sampler &sampler)
+{
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return uniform_ball(u, v, sampler.next_float());
+}
+
+inline vec3 random_cosine_direction(const vec3 &normal, Sampler &sampler)
+{
+    float u = 0, v = 0;
+    sampler.next_2d(u, v);
+    return cosine_hemisphere(normal, u, v);
 }
 
 inline vec3 reflect(const vec3& v, const vec3& n)
@@ -248,4 +388,12 @@ inline vec3 reflect(const vec3& v, const vec3& n)
     return vec3( _mm_sub_ps(v.xmm, scaled_n) );
 }
 
+// a finished pixel's color, 0..1, as the 0..255.99 that writePixel() (in
+// ../thread_pool.h) cuts down to bytes: the square root is the gamma (2),
+// done on all three channels at once
+inline vec3 to_display(const vec3 &col)
+{
+    return vec3(_mm_mul_ps(_mm_sqrt_ps(col.xmm), _mm_set1_ps(255.99f)));
+}
+
 #endif
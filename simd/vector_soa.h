@@ -0,0 +1,369 @@
+#ifndef VECTORSOAH
+#define VECTORSOAH
+
+#include <immintrin.h>
+#include "vector.h"
+
+// Structure-of-arrays vectors. Where vec3 packs x,y,z (and a wasted fourth
+// lane) into one register, these keep all the x's in one register, all the
+// y's in another, and all the z's in a third. Each lane is a whole separate
+// vector, so four (vec3x4) or eight (vec3x8) rays/spheres/normals go through
+// every instruction together, and dot() and friends need no shuffles or
+// horizontal adds at all.
+//
+// "Scalar" results (dot, length, ...) come back as a plain __m128/__m256 with
+// one answer per lane. Comparisons produce per-lane masks (all-ones or
+// all-zeros), which select() uses to blend two vectors lane-by-lane.
+//
+// vec3x4 needs SSE4.1 (for blendv); vec3x8 needs AVX, and is only defined
+// when compiling with it (-mavx or better).
+
+
+// ---------------------------------------------------------------- vec3x4 ---
+
+class vec3x4
+{
+public:
+    vec3x4() { x = y = z = _mm_setzero_ps(); }
+    vec3x4(__m128 x, __m128 y, __m128 z) : x(x), y(y), z(z) {}
+    // same vector in every lane
+    vec3x4(const vec3 &v) { x = _mm_set1_ps(v[0]); y = _mm_set1_ps(v[1]); z = _mm_set1_ps(v[2]); }
+
+    // from three separate arrays of (at least) four floats each
+    static inline vec3x4 load(const float *xs, const float *ys, const float *zs);
+    // from four ordinary vec3's; a 4x4 transpose
+    static inline vec3x4 gather(const vec3 &v0, const vec3 &v1, const vec3 &v2, const vec3 &v3);
+
+    inline vec3 get(int lane) const;
+    inline void set(int lane, const vec3 &v);
+
+    inline vec3x4& operator+=(const vec3x4 &v) { x = _mm_add_ps(x, v.x); y = _mm_add_ps(y, v.y); z = _mm_add_ps(z, v.z); return *this; }
+    inline vec3x4& operator-=(const vec3x4 &v) { x = _mm_sub_ps(x, v.x); y = _mm_sub_ps(y, v.y); z = _mm_sub_ps(z, v.z); return *this; }
+    inline vec3x4& operator*=(const vec3x4 &v) { x = _mm_mul_ps(x, v.x); y = _mm_mul_ps(y, v.y); z = _mm_mul_ps(z, v.z); return *this; }
+    inline vec3x4& operator*=(__m128 t)        { x = _mm_mul_ps(x, t);   y = _mm_mul_ps(y, t);   z = _mm_mul_ps(z, t);   return *this; }
+
+    inline __m128 squared_length() const;
+    inline __m128 length() const;
+
+    __m128 x, y, z;
+};
+
+inline vec3x4 vec3x4::load(const float *xs, const float *ys, const float *zs)
+{
+    return vec3x4(_mm_loadu_ps(xs), _mm_loadu_ps(ys), _mm_loadu_ps(zs));
+}
+
+inline vec3x4 vec3x4::gather(const vec3 &v0, const vec3 &v1, const vec3 &v2, const vec3 &v3)
+{
+    __m128 r0 = v0.xmm, r1 = v1.xmm, r2 = v2.xmm, r3 = v3.xmm;
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);   // r3 is the unused fourth component
+    return vec3x4(r0, r1, r2);
+}
+
+inline vec3 vec3x4::get(int lane) const
+{
+    alignas(16) float xs[4], ys[4], zs[4];
+    _mm_store_ps(xs, x); _mm_store_ps(ys, y); _mm_store_ps(zs, z);
+    return vec3(xs[lane], ys[lane], zs[lane]);
+}
+
+inline void vec3x4::set(int lane, const vec3 &v)
+{
+    alignas(16) float xs[4], ys[4], zs[4];
+    _mm_store_ps(xs, x); _mm_store_ps(ys, y); _mm_store_ps(zs, z);
+    xs[lane] = v[0]; ys[lane] = v[1]; zs[lane] = v[2];
+    x = _mm_load_ps(xs); y = _mm_load_ps(ys); z = _mm_load_ps(zs);
+}
+
+inline vec3x4 operator+(const vec3x4 &a, const vec3x4 &b) { return vec3x4(_mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z)); }
+inline vec3x4 operator-(const vec3x4 &a, const vec3x4 &b) { return vec3x4(_mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z)); }
+inline vec3x4 operator*(const vec3x4 &a, const vec3x4 &b) { return vec3x4(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y), _mm_mul_ps(a.z, b.z)); }
+inline vec3x4 operator*(__m128 t, const vec3x4 &v)        { return vec3x4(_mm_mul_ps(t, v.x), _mm_mul_ps(t, v.y), _mm_mul_ps(t, v.z)); }
+inline vec3x4 operator*(const vec3x4 &v, __m128 t)        { return t * v; }
+inline vec3x4 operator*(float t, const vec3x4 &v)         { return _mm_set1_ps(t) * v; }
+inline vec3x4 operator/(const vec3x4 &v, __m128 t)        { return vec3x4(_mm_div_ps(v.x, t), _mm_div_ps(v.y, t), _mm_div_ps(v.z, t)); }
+inline vec3x4 operator-(const vec3x4 &v)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    return vec3x4(_mm_xor_ps(v.x, sign), _mm_xor_ps(v.y, sign), _mm_xor_ps(v.z, sign));
+}
+
+inline __m128 dot(const vec3x4 &a, const vec3x4 &b)
+{
+    // no horizontal add needed; every lane is its own dot product
+    __m128 d = _mm_mul_ps(a.x, b.x);
+    d = _mm_add_ps(d, _mm_mul_ps(a.y, b.y));
+    return _mm_add_ps(d, _mm_mul_ps(a.z, b.z));
+}
+
+inline __m128 vec3x4::squared_length() const { return dot(*this, *this); }
+inline __m128 vec3x4::length() const { return _mm_sqrt_ps(squared_length()); }
+
+inline vec3x4 cross(const vec3x4 &a, const vec3x4 &b)
+{
+    return vec3x4(
+        _mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+        _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+        _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x)));
+}
+
+inline vec3x4 normalize(const vec3x4 &v)
+{
+    // rsqrt is only good to ~12 bits; one Newton-Raphson step gets it to
+    // nearly full float precision:  r' = r * (1.5 - 0.5 * l2 * r*r)
+    const __m128 l2 = v.squared_length();
+    const __m128 r = _mm_rsqrt_ps(l2);
+    const __m128 rr = _mm_mul_ps(_mm_mul_ps(r, r), _mm_mul_ps(l2, _mm_set1_ps(0.5f)));
+    return v * _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), rr));
+}
+
+// v - 2n * dot(v,n), per lane
+inline vec3x4 reflect(const vec3x4 &v, const vec3x4 &n)
+{
+    const __m128 d = _mm_mul_ps(dot(v, n), _mm_set1_ps(2.0f));
+    return v - d * n;
+}
+
+// per lane: mask ? a : b
+inline vec3x4 select(__m128 mask, const vec3x4 &a, const vec3x4 &b)
+{
+    return vec3x4(_mm_blendv_ps(b.x, a.x, mask), _mm_blendv_ps(b.y, a.y, mask), _mm_blendv_ps(b.z, a.z, mask));
+}
+
+// per-lane mask of where a and b agree to within VEC3_EQUALS_EPSILON
+inline __m128 equal(const vec3x4 &a, const vec3x4 &b)
+{
+    const __m128 eps = _mm_set1_ps(VEC3_EQUALS_EPSILON);
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 dx = _mm_and_ps(_mm_sub_ps(a.x, b.x), absmask);
+    const __m128 dy = _mm_and_ps(_mm_sub_ps(a.y, b.y), absmask);
+    const __m128 dz = _mm_and_ps(_mm_sub_ps(a.z, b.z), absmask);
+    return _mm_and_ps(_mm_cmple_ps(dx, eps), _mm_and_ps(_mm_cmple_ps(dy, eps), _mm_cmple_ps(dz, eps)));
+}
+
+// smallest of the four lanes, broadcast to all of them
+inline __m128 hmin(__m128 v)
+{
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1,0,3,2)));
+}
+
+// sampling, four at a time; see vector.h
+inline vec3x4 uniform_sphere(__m128 u, __m128 v)
+{
+    vec3x4 r;
+    uniform_sphere_ps(u, v, r.x, r.y, r.z);
+    return r;
+}
+
+inline vec3x4 uniform_ball(__m128 u, __m128 v, __m128 w)
+{
+    vec3x4 r;
+    uniform_ball_ps(u, v, w, r.x, r.y, r.z);
+    return r;
+}
+
+inline vec3x4 cosine_hemisphere(const vec3x4 &normal, __m128 u, __m128 v)
+{
+    vec3x4 r;
+    cosine_hemisphere_ps(normal.x, normal.y, normal.z, u, v, r.x, r.y, r.z);
+    return r;
+}
+
+
+// ---------------------------------------------------------------- vec3x8 ---
+
+#ifdef __AVX__
+
+class vec3x8
+{
+public:
+    vec3x8() { x = y = z = _mm256_setzero_ps(); }
+    vec3x8(__m256 x, __m256 y, __m256 z) : x(x), y(y), z(z) {}
+    // same vector in every lane
+    vec3x8(const vec3 &v) { x = _mm256_set1_ps(v[0]); y = _mm256_set1_ps(v[1]); z = _mm256_set1_ps(v[2]); }
+    // two vec3x4's side by side; a is lanes 0-3, b is lanes 4-7
+    vec3x8(const vec3x4 &a, const vec3x4 &b)
+    {
+        x = _mm256_set_m128(b.x, a.x);
+        y = _mm256_set_m128(b.y, a.y);
+        z = _mm256_set_m128(b.z, a.z);
+    }
+
+    // from three separate arrays of (at least) eight floats each
+    static inline vec3x8 load(const float *xs, const float *ys, const float *zs);
+
+    inline vec3 get(int lane) const;
+    inline void set(int lane, const vec3 &v);
+    inline vec3x4 lo() const { return vec3x4(_mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z)); }
+    inline vec3x4 hi() const { return vec3x4(_mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1)); }
+
+    inline vec3x8& operator+=(const vec3x8 &v) { x = _mm256_add_ps(x, v.x); y = _mm256_add_ps(y, v.y); z = _mm256_add_ps(z, v.z); return *this; }
+    inline vec3x8& operator-=(const vec3x8 &v) { x = _mm256_sub_ps(x, v.x); y = _mm256_sub_ps(y, v.y); z = _mm256_sub_ps(z, v.z); return *this; }
+    inline vec3x8& operator*=(const vec3x8 &v) { x = _mm256_mul_ps(x, v.x); y = _mm256_mul_ps(y, v.y); z = _mm256_mul_ps(z, v.z); return *this; }
+    inline vec3x8& operator*=(__m256 t)        { x = _mm256_mul_ps(x, t);   y = _mm256_mul_ps(y, t);   z = _mm256_mul_ps(z, t);   return *this; }
+
+    inline __m256 squared_length() const;
+    inline __m256 length() const;
+
+    __m256 x, y, z;
+};
+
+inline vec3x8 vec3x8::load(const float *xs, const float *ys, const float *zs)
+{
+    return vec3x8(_mm256_loadu_ps(xs), _mm256_loadu_ps(ys), _mm256_loadu_ps(zs));
+}
+
+inline vec3 vec3x8::get(int lane) const
+{
+    alignas(32) float xs[8], ys[8], zs[8];
+    _mm256_store_ps(xs, x); _mm256_store_ps(ys, y); _mm256_store_ps(zs, z);
+    return vec3(xs[lane], ys[lane], zs[lane]);
+}
+
+inline void vec3x8::set(int lane, const vec3 &v)
+{
+    alignas(32) float xs[8], ys[8], zs[8];
+    _mm256_store_ps(xs, x); _mm256_store_ps(ys, y); _mm256_store_ps(zs, z);
+    xs[lane] = v[0]; ys[lane] = v[1]; zs[lane] = v[2];
+    x = _mm256_load_ps(xs); y = _mm256_load_ps(ys); z = _mm256_load_ps(zs);
+}
+
+inline vec3x8 operator+(const vec3x8 &a, const vec3x8 &b) { return vec3x8(_mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z)); }
+inline vec3x8 operator-(const vec3x8 &a, const vec3x8 &b) { return vec3x8(_mm256_sub_ps(a.x, b.x), _mm256_sub_ps(a.y, b.y), _mm256_sub_ps(a.z, b.z)); }
+inline vec3x8 operator*(const vec3x8 &a, const vec3x8 &b) { return vec3x8(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y), _mm256_mul_ps(a.z, b.z)); }
+inline vec3x8 operator*(__m256 t, const vec3x8 &v)        { return vec3x8(_mm256_mul_ps(t, v.x), _mm256_mul_ps(t, v.y), _mm256_mul_ps(t, v.z)); }
+inline vec3x8 operator*(const vec3x8 &v, __m256 t)        { return t * v; }
+inline vec3x8 operator*(float t, const vec3x8 &v)         { return _mm256_set1_ps(t) * v; }
+inline vec3x8 operator/(const vec3x8 &v, __m256 t)        { return vec3x8(_mm256_div_ps(v.x, t), _mm256_div_ps(v.y, t), _mm256_div_ps(v.z, t)); }
+inline vec3x8 operator-(const vec3x8 &v)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    return vec3x8(_mm256_xor_ps(v.x, sign), _mm256_xor_ps(v.y, sign), _mm256_xor_ps(v.z, sign));
+}
+
+inline __m256 dot(const vec3x8 &a, const vec3x8 &b)
+{
+    __m256 d = _mm256_mul_ps(a.x, b.x);
+    d = _mm256_add_ps(d, _mm256_mul_ps(a.y, b.y));
+    return _mm256_add_ps(d, _mm256_mul_ps(a.z, b.z));
+}
+
+inline __m256 vec3x8::squared_length() const { return dot(*this, *this); }
+inline __m256 vec3x8::length() const { return _mm256_sqrt_ps(squared_length()); }
+
+inline vec3x8 cross(const vec3x8 &a, const vec3x8 &b)
+{
+    return vec3x8(
+        _mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)),
+        _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(a.x, b.z)),
+        _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x)));
+}
+
+inline vec3x8 normalize(const vec3x8 &v)
+{
+    // see the vec3x4 version
+    const __m256 l2 = v.squared_length();
+    const __m256 r = _mm256_rsqrt_ps(l2);
+    const __m256 rr = _mm256_mul_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(l2, _mm256_set1_ps(0.5f)));
+    return v * _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5f), rr));
+}
+
+inline vec3x8 reflect(const vec3x8 &v, const vec3x8 &n)
+{
+    const __m256 d = _mm256_mul_ps(dot(v, n), _mm256_set1_ps(2.0f));
+    return v - d * n;
+}
+
+inline vec3x8 select(__m256 mask, const vec3x8 &a, const vec3x8 &b)
+{
+    return vec3x8(_mm256_blendv_ps(b.x, a.x, mask), _mm256_blendv_ps(b.y, a.y, mask), _mm256_blendv_ps(b.z, a.z, mask));
+}
+
+inline __m256 equal(const vec3x8 &a, const vec3x8 &b)
+{
+    const __m256 eps = _mm256_set1_ps(VEC3_EQUALS_EPSILON);
+    const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    const __m256 dx = _mm256_and_ps(_mm256_sub_ps(a.x, b.x), absmask);
+    const __m256 dy = _mm256_and_ps(_mm256_sub_ps(a.y, b.y), absmask);
+    const __m256 dz = _mm256_and_ps(_mm256_sub_ps(a.z, b.z), absmask);
+    return _mm256_and_ps(_mm256_cmp_ps(dx, eps, _CMP_LE_OQ),
+           _mm256_and_ps(_mm256_cmp_ps(dy, eps, _CMP_LE_OQ), _mm256_cmp_ps(dz, eps, _CMP_LE_OQ)));
+}
+
+// smallest of the eight lanes, broadcast to all of them
+inline __m256 hmin(__m256 v)
+{
+    v = _mm256_min_ps(v, _mm256_permute2f128_ps(v, v, 1));   // swap 128-bit halves
+    v = _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2,3,0,1)));
+    return _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1,0,3,2)));
+}
+
+// sincos_ps() and cbrt_ps() from vector.h, eight wide. every step is the
+// same as there, so each lane's answer is exactly what they'd give.
+inline void sincos256_ps(__m256 x, __m256 &s, __m256 &c)
+{
+    const __m256 q = _mm256_floor_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_floor_ps(_mm256_mul_ps(x, _mm256_set1_ps(float(4.0 / M_PI)))), _mm256_set1_ps(1.0f)), _mm256_set1_ps(0.5f)));
+    const __m256 r = _mm256_sub_ps(q, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(q, _mm256_set1_ps(0.25f))), _mm256_set1_ps(4.0f)));
+    const __m256 y = _mm256_add_ps(q, q);
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(3.77489497744594108e-8f)));
+    const __m256 z = _mm256_mul_ps(x, x);
+
+    __m256 cp = _mm256_set1_ps(2.443315711809948e-5f);
+    cp = _mm256_add_ps(_mm256_mul_ps(cp, z), _mm256_set1_ps(-1.388731625493765e-3f));
+    cp = _mm256_add_ps(_mm256_mul_ps(cp, z), _mm256_set1_ps(4.166664568298827e-2f));
+    cp = _mm256_mul_ps(_mm256_mul_ps(cp, z), z);
+    cp = _mm256_add_ps(_mm256_sub_ps(cp, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))), _mm256_set1_ps(1.0f));
+    __m256 sp = _mm256_set1_ps(-1.9515295891e-4f);
+    sp = _mm256_add_ps(_mm256_mul_ps(sp, z), _mm256_set1_ps(8.3321608736e-3f));
+    sp = _mm256_add_ps(_mm256_mul_ps(sp, z), _mm256_set1_ps(-1.6666654611e-1f));
+    sp = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(sp, z), x), x);
+
+    const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), three = _mm256_set1_ps(3.0f);
+    const __m256 swap = _mm256_or_ps(_mm256_cmp_ps(r, one, _CMP_EQ_OQ), _mm256_cmp_ps(r, three, _CMP_EQ_OQ));
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 sinSign = _mm256_and_ps(_mm256_cmp_ps(r, two, _CMP_GE_OQ), sign);
+    const __m256 cosSign = _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(r, one, _CMP_EQ_OQ), _mm256_cmp_ps(r, two, _CMP_EQ_OQ)), sign);
+    s = _mm256_xor_ps(_mm256_blendv_ps(sp, cp, swap), sinSign);
+    c = _mm256_xor_ps(_mm256_blendv_ps(cp, sp, swap), cosSign);
+}
+
+inline __m256 cbrt256_ps(__m256 w)
+{
+    const __m256 bits = _mm256_cvtepi32_ps(_mm256_castps_si256(w));
+    __m256 r = _mm256_castsi256_ps(_mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(bits, _mm256_set1_ps(1.0f / 3.0f)), _mm256_set1_ps(709921077.0f))));
+    const __m256 third = _mm256_set1_ps(1.0f / 3.0f);
+    r = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(r, r), _mm256_div_ps(w, _mm256_mul_ps(r, r))), third);
+    r = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(r, r), _mm256_div_ps(w, _mm256_mul_ps(r, r))), third);
+    return r;
+}
+
+// sampling, eight at a time; see the vec3x4 versions
+inline vec3x8 uniform_sphere(__m256 u, __m256 v)
+{
+    const __m256 z = _mm256_sub_ps(_mm256_mul_ps(u, _mm256_set1_ps(2.0f)), _mm256_set1_ps(1.0f));
+    const __m256 r = _mm256_sqrt_ps(_mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(z, z))));
+    __m256 s, c;
+    sincos256_ps(_mm256_mul_ps(v, _mm256_set1_ps(2.0f * float(M_PI))), s, c);
+    return vec3x8(_mm256_mul_ps(r, c), _mm256_mul_ps(r, s), z);
+}
+
+inline vec3x8 uniform_ball(__m256 u, __m256 v, __m256 w)
+{
+    return uniform_sphere(u, v) * cbrt256_ps(w);
+}
+
+inline vec3x8 cosine_hemisphere(const vec3x8 &normal, __m256 u, __m256 v)
+{
+    const vec3x8 dir = normal + uniform_sphere(u, v);
+    __m256 l2 = _mm256_mul_ps(dir.x, dir.x);
+    l2 = _mm256_add_ps(l2, _mm256_mul_ps(dir.y, dir.y));
+    l2 = _mm256_add_ps(l2, _mm256_mul_ps(dir.z, dir.z));
+    return select(_mm256_cmp_ps(l2, _mm256_set1_ps(1e-8f), _CMP_LT_OQ), normal, dir);
+}
+
+#endif  // __AVX__
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef WIDEBVHH
+#define WIDEBVHH
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "vector.h"
+#include "../ray.h"
+#include "ray_packet.h"
+#include "../hitable.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "aabb.h"
+#include "bvh.h"
+
+// A BVH with W (4 or 8) children per node instead of 2, made by collapsing a
+// binary BVH: each wide node starts from a binary node's two children and
+// keeps opening up the biggest interior one until it has W. The children's
+// boxes are stored one array per component, so a ray is tested against all
+// of them in one go: one SSE pass for W=4, one AVX pass for W=8 (or two SSE
+// passes without AVX). Leaves aren't nodes of their own; a child slot just
+// points straight at its leaf's group of spheres in the SphereBatch.
+//
+// Compared to the binary BVH, that's fewer trips around the traversal loop
+// and far fewer box tests done one at a time.
+
+// each level down can add up to W-1 entries, and the binary tree is at most
+// BVH_MAX_SAH_DEPTH plus a few dozen median splits deep
+#define WIDE_BVH_STACK_SIZE 1024
+
+template <int W>
+struct alignas(64) WideBVHNode
+{
+    float bminX[W], bminY[W], bminZ[W];
+    float bmaxX[W], bmaxY[W], bmaxZ[W];
+    uint32_t child[W];   // interior child: index of its node; leaf child: first sphere
+    uint32_t count[W];   // number of spheres for a leaf child; 0 for interior
+
+    // every slot starts out empty, with a box sitting out at infinity. the
+    // slab test can never pass that, whatever direction the ray goes.
+    WideBVHNode()
+    {
+        for (int i = 0; i < W; i++)
+        {
+            bminX[i] = bminY[i] = bminZ[i] = INFINITY;
+            bmaxX[i] = bmaxY[i] = bmaxZ[i] = INFINITY;
+            child[i] = count[i] = 0;
+        }
+    }
+};
+
+// a ray set up for testing against a node: origin and 1/direction, each
+// component broadcast across a whole register
+template <int W> struct wide_ray;
+
+template <> struct wide_ray<4>
+{
+    wide_ray(const vec3 &origin, const vec3 &invDir)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            o[i] = _mm_set1_ps(origin[i]);
+            inv[i] = _mm_set1_ps(invDir[i]);
+        }
+    }
+    __m128 o[3], inv[3];
+};
+
+#ifdef __AVX__
+template <> struct wide_ray<8>
+{
+    wide_ray(const vec3 &origin, const vec3 &invDir)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            o[i] = _mm256_set1_ps(origin[i]);
+            inv[i] = _mm256_set1_ps(invDir[i]);
+        }
+    }
+    __m256 o[3], inv[3];
+};
+#else
+// no AVX: 8-wide nodes get tested as two halves
+template <> struct wide_ray<8> : wide_ray<4>
+{
+    wide_ray(const vec3 &origin, const vec3 &invDir) : wide_ray<4>(origin, invDir) {}
+};
+#endif
+
+// slab test for four of a node's children starting at slot first, same idea
+// as slab_test() in aabb.h. returns a bitmask of the boxes the ray goes
+// through inside [tMin,tMax], and writes their entry distances to tNear.
+template <int W>
+inline int wide_slab_test4(const WideBVHNode<W> &node, int first, const wide_ray<4> &r,
+                           float tMin, float tMax, float *tNear)
+{
+    const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminX + first), r.o[0]), r.inv[0]);
+    const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxX + first), r.o[0]), r.inv[0]);
+    const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminY + first), r.o[1]), r.inv[1]);
+    const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxY + first), r.o[1]), r.inv[1]);
+    const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bminZ + first), r.o[2]), r.inv[2]);
+    const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmaxZ + first), r.o[2]), r.inv[2]);
+    const __m128 tn = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                 _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tMin)));
+    const __m128 tf = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                 _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+    _mm_storeu_ps(tNear, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+}
+
+inline int wide_slab_test(const WideBVHNode<4> &node, const wide_ray<4> &r,
+                          float tMin, float tMax, float *tNear)
+{
+    return wide_slab_test4(node, 0, r, tMin, tMax, tNear);
+}
+
+inline int wide_slab_test(const WideBVHNode<8> &node, const wide_ray<8> &r,
+                          float tMin, float tMax, float *tNear)
+{
+#ifdef __AVX__
+    const __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminX), r.o[0]), r.inv[0]);
+    const __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxX), r.o[0]), r.inv[0]);
+    const __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminY), r.o[1]), r.inv[1]);
+    const __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxY), r.o[1]), r.inv[1]);
+    const __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bminZ), r.o[2]), r.inv[2]);
+    const __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bmaxZ), r.o[2]), r.inv[2]);
+    const __m256 tn = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                    _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_set1_ps(tMin)));
+    const __m256 tf = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                    _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(tMax)));
+    _mm256_storeu_ps(tNear, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+#else
+    return wide_slab_test4(node, 0, r, tMin, tMax, tNear)
+         | wide_slab_test4(node, 4, r, tMin, tMax, tNear + 4) << 4;
+#endif
+}
+
+template <int W>
+class WideBVH : public Hitable
+{
+public:
+    WideBVH() {}
+    WideBVH(Sphere **list, int n, ThreadPool *pPool = nullptr);
+
+    bool intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const override;
+    void resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const override;
+    bool occluded(const ray &rayIn, float tMin, float tMax) const override;
+    void intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const override;
+
+    uint32_t numNodes() const { return m_nodes.size(); }
+    uint32_t numSpheres() const { return m_leaves.size(); }
+
+private:
+    uint32_t m_collapse(const std::vector<BVHNode> &binary, uint32_t node);
+
+    std::vector<WideBVHNode<W>> m_nodes;
+    SphereBatch m_leaves;    // the binary BVH's, one group per leaf; leaf slots index into this
+};
+
+
+template <int W>
+WideBVH<W>::WideBVH(Sphere **list, int n, ThreadPool *pPool)
+{
+    BVH binary(list, n, pPool);
+    m_leaves = binary.leaves();
+    m_nodes.reserve(binary.numNodes() / 2 + 1);
+    if (n > 0) m_collapse(binary.nodes(), 0);
+    else m_nodes.push_back(WideBVHNode<W>());
+}
+
+// makes a wide node out of the binary subtree under node, and returns its
+// index
+template <int W>
+uint32_t WideBVH<W>::m_collapse(const std::vector<BVHNode> &binary, uint32_t node)
+{
+    // start from the node's two children, then keep replacing the interior
+    // one with the biggest surface area (the one a ray is likeliest to go
+    // into) by its own two children, until there are W of them
+    uint32_t kids[W];
+    int numKids = 0;
+    if (binary[node].isLeaf()) kids[numKids++] = node;   // only for a root that's a leaf
+    else
+    {
+        kids[numKids++] = binary[node].leftOrFirst;
+        kids[numKids++] = binary[node].leftOrFirst + 1;
+    }
+    while (numKids < W)
+    {
+        int best = -1;
+        float bestArea = -1;
+        for (int i = 0; i < numKids; i++)
+        {
+            const BVHNode &k = binary[kids[i]];
+            if (k.isLeaf()) continue;
+            const float area = aabb(vec3(k.bmin[0], k.bmin[1], k.bmin[2]),
+                                    vec3(k.bmax[0], k.bmax[1], k.bmax[2])).surface_area();
+            if (area > bestArea) { bestArea = area; best = i; }
+        }
+        if (best < 0) break;
+        const uint32_t left = binary[kids[best]].leftOrFirst;
+        kids[best] = left;
+        kids[numKids++] = left + 1;
+    }
+
+    const uint32_t index = m_nodes.size();
+    m_nodes.push_back(WideBVHNode<W>());
+    for (int i = 0; i < numKids; i++)
+    {
+        const BVHNode &k = binary[kids[i]];
+        WideBVHNode<W> &wide = m_nodes[index];
+        wide.bminX[i] = k.bmin[0]; wide.bminY[i] = k.bmin[1]; wide.bminZ[i] = k.bmin[2];
+        wide.bmaxX[i] = k.bmax[0]; wide.bmaxY[i] = k.bmax[1]; wide.bmaxZ[i] = k.bmax[2];
+        wide.child[i] = k.leftOrFirst;
+        wide.count[i] = k.count;
+    }
+    // m_nodes grows while collapsing the children, so no holding on to a
+    // reference across these
+    for (int i = 0; i < numKids; i++)
+        if (!binary[kids[i]].isLeaf())
+        {
+            const uint32_t c = m_collapse(binary, kids[i]);
+            m_nodes[index].child[i] = c;
+        }
+    return index;
+}
+
+template <int W>
+bool WideBVH<W>::intersect(const ray &rayIn, float tMin, float tMax, hit_info &info) const
+{
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    const wide_ray<W> r(rayIn.origin(), invDir);
+
+    // nodes still to visit, along with where the ray enters them; once
+    // something closer has been hit, those can be skipped when popped
+    struct entry { uint32_t node; float t; };
+    entry stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+
+    bool hitAnything = false;
+    float closest = tMax;
+    uint32_t closestIndex = 0;
+    uint32_t current = 0;
+    while (true)
+    {
+        const WideBVHNode<W> &node = m_nodes[current];
+        alignas(32) float tNear[W];
+        int mask = wide_slab_test(node, r, tMin, closest, tNear);
+
+        // leaves get tested on the spot. the child nodes that were hit are
+        // sorted far to near, so the nearest one can be gone into next and
+        // the rest pushed for later.
+        entry hits[W];
+        int numHits = 0;
+        while (mask)
+        {
+            const int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] > 0)
+            {
+                const int s = m_leaves.closest(rayIn, node.child[i], node.count[i], tMin, closest, closest);
+                if (s >= 0)
+                {
+                    hitAnything = true;
+                    closestIndex = s;
+                }
+                continue;
+            }
+            int j = numHits++;
+            for (; j > 0 && hits[j-1].t < tNear[i]; j--) hits[j] = hits[j-1];
+            hits[j] = { node.child[i], tNear[i] };
+        }
+
+        if (numHits > 0 && hits[numHits-1].t < closest)
+        {
+            for (int i = 0; i < numHits - 1; i++) stack[stackSize++] = hits[i];
+            current = hits[numHits-1].node;
+            continue;
+        }
+
+        // nothing (or nothing nearer than what's been hit) down here, so
+        // back up to the next node on the stack that's still worth a look
+        do
+        {
+            if (stackSize == 0)
+            {
+                if (hitAnything) info = { closest, closestIndex, this };
+                return hitAnything;
+            }
+            current = stack[--stackSize].node;
+        } while (stack[stackSize].t >= closest);
+    }
+}
+
+template <int W>
+void WideBVH<W>::resolve(const ray &rayIn, const hit_info &info, hit_record &rec) const
+{
+    m_leaves.fill(rayIn, info.prim, info.t, rec);
+}
+
+// like BVH::occluded: stops at the first hit, and the children are visited
+// in whatever order they come, since there's no closest hit to shrink
+template <int W>
+bool WideBVH<W>::occluded(const ray &rayIn, float tMin, float tMax) const
+{
+    const vec3 dir = rayIn.direction();
+    const vec3 invDir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    const wide_ray<W> r(rayIn.origin(), invDir);
+
+    uint32_t stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const WideBVHNode<W> &node = m_nodes[stack[--stackSize]];
+        alignas(32) float tNear[W];
+        int mask = wide_slab_test(node, r, tMin, tMax, tNear);
+        while (mask)
+        {
+            const int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (node.count[i] == 0)
+            {
+                stack[stackSize++] = node.child[i];
+                continue;
+            }
+            if (m_leaves.any(rayIn, node.child[i], node.count[i], tMin, tMax)) return true;
+        }
+    }
+    return false;
+}
+
+// like BVH::intersect_packet: the packet visits a child if any of its rays go
+// through it. each child box is tested against the packet's rays four at a
+// time, rather than one ray against all W boxes.
+template <int W>
+void WideBVH<W>::intersect_packet(RayPacket &packet, float tMin, hit_info *pInfos) const
+{
+    const vec3 dir(packet.dx[0], packet.dy[0], packet.dz[0]);
+    const PacketBounds bounds = packet_bounds(packet);
+
+    uint32_t stack[WIDE_BVH_STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const WideBVHNode<W> &node = m_nodes[stack[--stackSize]];
+
+        // child nodes that were hit, sorted by how far along the first ray
+        // they are, far to near
+        struct child { uint32_t node; float d; };
+        child hits[W];
+        int numHits = 0;
+        for (int i = 0; i < W; i++)
+        {
+            if (node.bminX[i] == INFINITY) break;   // empty slots are all at the end
+            // four floats each, since packet_misses_box reads them that way
+            const float bmin[4] = { node.bminX[i], node.bminY[i], node.bminZ[i], 0 };
+            const float bmax[4] = { node.bmaxX[i], node.bmaxY[i], node.bmaxZ[i], 0 };
+
+            if (node.count[i] > 0)
+            {
+                for (int g = 0; g < PACKET_GROUPS; g++)
+                {
+                    int mask = packet_group_hits_box(packet, g, bmin, bmax, tMin);
+                    while (mask)
+                    {
+                        const int r = 4*g + __builtin_ctz(mask);
+                        mask &= mask - 1;
+                        const int s = m_leaves.closest(packet.get(r), node.child[i], node.count[i], tMin, packet.tMax[r], packet.tMax[r]);
+                        if (s >= 0) pInfos[r] = { packet.tMax[r], uint32_t(s), this };
+                    }
+                }
+                continue;
+            }
+
+            if (!packet_hits_box(packet, bounds, bmin, bmax, tMin)) continue;
+            const float d = dot(vec3(bmin[0] + bmax[0], bmin[1] + bmax[1], bmin[2] + bmax[2]), dir);
+            int j = numHits++;
+            for (; j > 0 && hits[j-1].d < d; j--) hits[j] = hits[j-1];
+            hits[j] = { node.child[i], d };
+        }
+        for (int i = 0; i < numHits; i++) stack[stackSize++] = hits[i].node;
+    }
+}
+
+#endif
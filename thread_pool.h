@@ -0,0 +1,730 @@
+#ifndef THREADPOOLH
+#define THREADPOOLH
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+
+#include "work_deque.h"
+#include "settings.h"
+
+#include "ray.h"
+#include "hitable.h"
+#include "pixel_stats.h"
+#include "lights.h"
+// (the tree's camera.h, material.h and wavefront.h come first; its vector.h
+// also has the to_display() that writePixel() uses)
+
+struct threadInfo
+{
+    Hitable *pWorld;
+    MaterialTable *pMaterials;
+    LightList *pLights;          // may be null: no next event estimation
+    Camera *pCam;
+    PixelStats *pAccumBuffer;    // every pixel's samples so far, added up
+    uint32_t *pTextureBuffer;    // RGBA8, written by ThreadPool::resolve()
+};
+
+class ThreadPool
+{
+public:
+    ThreadPool(uint32_t num_threads, Scheduling mode = Scheduling::SharedCounter);
+    ~ThreadPool();
+
+    void init(threadInfo* global);
+    void start();
+    void stop();
+    bool busy();
+    uint32_t num_remaining();
+    uint32_t num_consumed();
+    uint32_t num_completed();
+    uint32_t num_total() { return m_total; }
+    uint32_t waitForProgress(uint32_t lastSeen, uint32_t timeoutMs);
+    void waitUntilDone();
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)> &fn);
+    uint32_t getNumThreads() { return m_num_threads; }
+    Scheduling getScheduling() { return m_scheduling; }
+    void setScheduling(Scheduling mode) { m_scheduling = mode; }
+    Integrator getIntegrator() { return m_integrator; }
+    void setIntegrator(Integrator integrator) { m_integrator = integrator; }
+    void setSamples(uint32_t count) { m_numSamples = count; }
+    void setAdaptive(bool adaptive) { m_adaptive = adaptive; }
+    void setRussianRoulette(bool on) { m_russianRoulette = on; }
+    void setNextEventEstimation(bool on) { m_nextEventEstimation = on; }
+    void setSampler(SamplerKind kind) { m_sampler = kind; }
+    void setMaxBounces(int count) { m_maxBounces = count; }
+    // the image's size; before init()
+    void setResolution(int width, int height) { m_width = width; m_height = height; }
+    int getWidth() { return m_width; }
+    int getHeight() { return m_height; }
+    uint64_t samplesTraced() { return m_samplesTraced.load(std::memory_order_relaxed); }
+    uint64_t raysTraced() { return m_raysTraced.load(std::memory_order_relaxed); }
+    void clear();
+    void resolve();
+    void resolveLinear(float *pRGB);
+    void resolveHeatmap();
+    double threadFinishSeconds(uint32_t i);
+    bool running();
+    std::atomic<bool> shouldTerminate{false};  // Tells threads to stop looking for jobs
+
+private:
+    void m_threadLoop(uint32_t threadIndex);
+    void m_helperLoop();
+    void m_runJob();
+    bool m_nextTile(uint32_t threadIndex, uint32_t &tile, uint32_t &rngState);
+
+    bool m_is_running = false;
+    Scheduling m_scheduling;
+    Integrator m_integrator = Integrator::Megakernel;
+    uint32_t m_numSamples = NUM_ALIAS_STEPS;      // per pixel, per run
+    bool m_adaptive = false;
+    bool m_russianRoulette = RUSSIAN_ROULETTE;
+    bool m_nextEventEstimation = NEXT_EVENT_ESTIMATION;
+    SamplerKind m_sampler = SAMPLER;
+    int m_maxBounces = MAX_NUM_REFLECTIONS;      // per path
+    int m_width = WINDOW_WIDTH, m_height = WINDOW_HEIGHT;
+    std::atomic<uint64_t> m_samplesTraced{0};     // this run, so far
+    std::atomic<uint64_t> m_raysTraced{0};        // same, counting every bounce
+    std::vector<float> m_noise;                   // per pixel, adaptive only
+    std::vector<uint8_t> m_active;                // pixels that get samples this run
+    uint32_t m_num_threads;
+    std::vector<std::thread> m_threads;
+    threadInfo* m_globalInfoPtr;
+    std::atomic<uint32_t> m_numConsumedSoFar{0};  // Next tile to hand out
+    std::atomic<uint32_t> m_numCompleted{0};      // Tiles fully rendered
+
+    // only used to sleep the waiting thread until m_numCompleted moves; the
+    // workers never wait on it
+    std::mutex m_progressMutex;
+    std::condition_variable m_progressCv;
+    uint32_t m_total;                             // Number of tiles
+    uint32_t m_numTilesX;
+    std::unique_ptr<WorkDeque[]> m_deques;        // One per thread, WorkStealing only
+    std::unique_ptr<Wavefront[]> m_wavefronts;    // One per thread, Wavefront only
+
+    // parallel_for()'s helpers: m_num_threads - 1 of them, so that with the
+    // calling thread there are as many working as in a render. they're made
+    // the first time it's called, and wait on m_jobCv between loops.
+    std::vector<std::thread> m_helpers;
+    std::mutex m_jobMutex;
+    std::condition_variable m_jobCv;              // a new loop, or time to quit
+    std::condition_variable m_jobDoneCv;          // the last helper is done with it
+    const std::function<void(uint32_t)> *m_pJob = nullptr;
+    uint32_t m_jobCount = 0;
+    std::atomic<uint32_t> m_jobNext{0};           // next index to hand out
+    uint64_t m_jobGeneration = 0;                 // one more for every loop
+    uint32_t m_jobHelpersBusy = 0;
+    bool m_helpersQuit = false;
+
+    // when each thread ran out of work, for measuring load balance
+    std::chrono::steady_clock::time_point m_startTime;
+    std::vector<std::chrono::steady_clock::time_point> m_finishTimes;
+
+    void doRayTrace(threadInfo *pGlobalInfo, uint32_t threadIndex, uint32_t tile);
+    uint64_t m_tracePacket(threadInfo *pGlobalInfo, const uint8_t *pActive, int x0, int y0, int px, int py, int x1, int y1);
+    void m_findActive();
+    vec3 color(ray& r, Hitable* pWorld, const MaterialTable &materials, const LightList *pLights, Sampler &sampler, uint32_t &numRays);
+    vec3 color(ray& r, Hitable* pWorld, const MaterialTable &materials, const LightList *pLights, Sampler &sampler, bool hit, hit_record &rec, uint32_t &numRays);
+};
+
+
+ThreadPool::ThreadPool(uint32_t n_threads, Scheduling mode)
+{
+    // std::thread::hardware_concurrency() returns the maximum amount
+    // of threads the system can support at once. Here I subtract one
+    // because I don't want my entire system to crawl to a halt. That,
+    // and the main thread still needs attention!
+    // hardware_concurrency() is allowed to return 0 when it can't tell,
+    // so never go below one worker.
+    const uint32_t hc = std::thread::hardware_concurrency();
+    const uint32_t m = (hc > 1)? hc - 1 : 1;
+    if (n_threads > m) m_num_threads = m;
+    else if (n_threads < 1) m_num_threads = 1;
+    else m_num_threads = n_threads;
+    m_threads = std::vector<std::thread>(m_num_threads);
+    m_finishTimes = std::vector<std::chrono::steady_clock::time_point>(m_num_threads);
+    m_deques.reset(new WorkDeque[m_num_threads]);
+    m_wavefronts.reset(new Wavefront[m_num_threads]);
+    m_scheduling = mode;
+    m_total = 0;
+}
+
+ThreadPool::~ThreadPool()
+{
+    if (m_is_running) stop();
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_helpersQuit = true;
+    }
+    m_jobCv.notify_all();
+    for (std::thread &helper : m_helpers) helper.join();
+}
+
+// a run (start() until every tile is done) traces m_numSamples more samples
+// for every pixel, and adds them to its entry in pAccumBuffer; clear() starts
+// the sums over. nothing is written to pTextureBuffer until resolve(). that
+// way an image can be built up a pass at a time, looked at in between, and
+// carried on with later.
+//
+// with adaptive sampling on, pixels that are already smooth enough are left
+// out of the run (see m_active and m_findActive()), so the samples go where
+// the noise is.
+void ThreadPool::init(threadInfo* global)
+{
+    m_globalInfoPtr = global;
+    // the image is cut up into TILE_WIDTH x TILE_HEIGHT tiles, which are the
+    // unit of work handed to the threads. edge tiles are clipped to the image.
+    m_numTilesX = (m_width + TILE_WIDTH - 1) / TILE_WIDTH;
+    const uint32_t numTilesY = (m_height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    m_total = m_numTilesX * numTilesY;
+    m_noise.resize(m_width * m_height);
+    m_active.resize(m_width * m_height);
+}
+
+// initialize all threads
+void ThreadPool::start()
+{
+    shouldTerminate = false;
+    m_numConsumedSoFar = 0;
+    m_numCompleted = 0;
+    m_samplesTraced = 0;
+    m_raysTraced = 0;
+    m_findActive();
+    if (m_scheduling == Scheduling::WorkStealing)
+    {
+        // deal out contiguous runs of tiles, so each thread starts on its own
+        // patch of the image. they're pushed backwards since the owner pops
+        // from the bottom; that way owners walk forwards through their run and
+        // thieves take from the far end of it.
+        for (uint32_t i = 0; i < m_num_threads; i++)
+        {
+            const uint32_t first = uint64_t(m_total) * i / m_num_threads;
+            const uint32_t last = uint64_t(m_total) * (i+1) / m_num_threads;
+            m_deques[i].reset(m_total);
+            for (uint32_t tile = last; tile > first; tile--)
+                m_deques[i].push(tile - 1);
+        }
+    }
+    m_startTime = std::chrono::steady_clock::now();
+    m_threads.clear();
+    for (uint32_t i = 0; i < m_num_threads; i++)
+    {
+        m_threads.emplace_back(&ThreadPool::m_threadLoop, this, i);
+    }
+    m_is_running = true;
+}
+
+void ThreadPool::stop() {
+    shouldTerminate = true;
+    for (std::thread& active_thread : m_threads) {
+        active_thread.join();
+    }
+    m_threads.clear();
+    m_is_running = false;
+}
+
+bool ThreadPool::busy() {
+    return num_completed() < m_total;
+}
+
+bool ThreadPool::running() {
+    return m_is_running;
+}
+
+uint32_t ThreadPool::num_remaining() {
+    return m_total - num_consumed();
+}
+
+uint32_t ThreadPool::num_consumed() {
+    // every thread bumps the counter once more when it finds the queue
+    // empty, so it can run past the end
+    const uint32_t len = m_numConsumedSoFar.load(std::memory_order_relaxed);
+    return (len < m_total)? len : m_total;
+}
+
+// tiles that are finished and written to the texture buffer. the acquire
+// pairs with the release in m_threadLoop, so those pixels are safe to read.
+uint32_t ThreadPool::num_completed() {
+    return m_numCompleted.load(std::memory_order_acquire);
+}
+
+// sleeps until more than lastSeen tiles are completed, or timeoutMs passes.
+// returns the number of completed tiles.
+uint32_t ThreadPool::waitForProgress(uint32_t lastSeen, uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_progressMutex);
+    m_progressCv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+        [&]{ return num_completed() != lastSeen; });
+    return num_completed();
+}
+
+void ThreadPool::waitUntilDone() {
+    std::unique_lock<std::mutex> lock(m_progressMutex);
+    m_progressCv.wait(lock, [&]{ return num_completed() >= m_total; });
+}
+
+// runs fn(0) .. fn(count-1) spread over the helpers, with the calling thread
+// pitching in too, and returns once they're all done. this is for the work
+// around a render: building the BVH, and clear(), resolve() and picking the
+// active pixels between runs. don't call it while the pool is running; the
+// render threads are using the cores, and what it's used for reads or writes
+// the buffers they're filling.
+void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)> &fn)
+{
+    if (m_num_threads == 1 || count <= 1)
+    {
+        for (uint32_t i = 0; i < count; i++) fn(i);
+        return;
+    }
+    if (m_helpers.empty())
+        for (uint32_t i = 0; i + 1 < m_num_threads; i++)
+            m_helpers.emplace_back(&ThreadPool::m_helperLoop, this);
+
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_pJob = &fn;
+        m_jobCount = count;
+        m_jobNext = 0;
+        m_jobHelpersBusy = m_helpers.size();
+        m_jobGeneration++;
+    }
+    m_jobCv.notify_all();
+    m_runJob();
+    std::unique_lock<std::mutex> lock(m_jobMutex);
+    m_jobDoneCv.wait(lock, [&]{ return m_jobHelpersBusy == 0; });
+    m_pJob = nullptr;
+}
+
+// takes indices of the current loop until there are none left
+void ThreadPool::m_runJob()
+{
+    for (uint32_t i = m_jobNext.fetch_add(1); i < m_jobCount; i = m_jobNext.fetch_add(1))
+        (*m_pJob)(i);
+}
+
+// every helper joins in on every loop, even if there's nothing left for it by
+// the time it wakes up; parallel_for() waits for all of them before setting
+// up the next, so none of them can miss one
+void ThreadPool::m_helperLoop()
+{
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(m_jobMutex);
+    while (true)
+    {
+        m_jobCv.wait(lock, [&]{ return m_helpersQuit || m_jobGeneration != seen; });
+        if (m_helpersQuit) return;
+        seen = m_jobGeneration;
+        lock.unlock();
+        m_runJob();
+        lock.lock();
+        if (--m_jobHelpersBusy == 0) m_jobDoneCv.notify_one();
+    }
+}
+
+// seconds from start() until thread i found no more work. only meaningful
+// once the pool has been stopped.
+double ThreadPool::threadFinishSeconds(uint32_t i) {
+    return std::chrono::duration<double>(m_finishTimes[i] - m_startTime).count();
+}
+
+bool ThreadPool::m_nextTile(uint32_t threadIndex, uint32_t &tile, uint32_t &rngState)
+{
+    if (m_scheduling == Scheduling::SharedCounter)
+    {
+        // grabbing a tile is a single atomic increment; no lock needed, since
+        // the tiles never overlap and each one is handed out exactly once.
+        tile = m_numConsumedSoFar.fetch_add(1, std::memory_order_relaxed);
+        return tile < m_total;
+    }
+
+    if (!m_deques[threadIndex].pop(tile))
+    {
+        // own deque is dry; go steal from random victims. tiles are never
+        // added once the render starts, so if a full sweep finds every deque
+        // empty (and not just contended) there is nothing left to do.
+        bool found = false;
+        bool contended = true;
+        while (!found && contended)
+        {
+            contended = false;
+            // xorshift32 picks where the sweep starts
+            rngState ^= rngState << 13;
+            rngState ^= rngState >> 17;
+            rngState ^= rngState << 5;
+            const uint32_t offset = rngState % m_num_threads;
+            for (uint32_t i = 0; i < m_num_threads && !found; i++)
+            {
+                const uint32_t victim = (offset + i) % m_num_threads;
+                if (victim == threadIndex) continue;
+                StealResult res = m_deques[victim].steal(tile);
+                found = (res == StealResult::Success);
+                contended |= (res == StealResult::Abort);
+            }
+        }
+        if (!found) return false;
+    }
+    m_numConsumedSoFar.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ThreadPool::m_threadLoop(uint32_t threadIndex)
+{
+    uint32_t rngState = 0x9E3779B9u * (threadIndex + 1);
+    uint32_t tile;
+    while (!shouldTerminate) {
+        if (!m_nextTile(threadIndex, tile, rngState))
+        {
+            shouldTerminate = true;
+            break;
+        }
+        doRayTrace(m_globalInfoPtr, threadIndex, tile);
+        m_numCompleted.fetch_add(1, std::memory_order_release);
+        {
+            // taking the lock (and dropping it straight away) means a waiter
+            // can't check the counter, miss this bump, and then go to sleep.
+            std::lock_guard<std::mutex> lock(m_progressMutex);
+        }
+        m_progressCv.notify_all();
+    }
+    m_finishTimes[threadIndex] = std::chrono::steady_clock::now();
+    return;
+}
+
+// numRays gets the number of rays the path took added on
+vec3 ThreadPool::color(ray& r, Hitable* pWorld, const MaterialTable &materials, const LightList *pLights, Sampler &sampler, uint32_t &numRays)
+{
+    hit_record rec;
+    const bool hit = pWorld->hit(r, 0.0001f, FLT_MAX, rec);
+    return color(r, pWorld, materials, pLights, sampler, hit, rec, numRays);
+}
+
+// same as above, for a ray whose first intersection has already been found
+// (by tracing it in a packet)
+vec3 ThreadPool::color(ray& r, Hitable* pWorld, const MaterialTable &materials, const LightList *pLights, Sampler &sampler, bool hit, hit_record &rec, uint32_t &numRays)
+{
+    const bool nee = m_nextEventEstimation && pLights && pLights->size() > 0;
+    vec3 radiance = vec3(0,0,0);           // light found so far
+    vec3 runningAttenuation = vec3(1,1,1);
+    vec3 attenuation;
+    float bsdfPdf = 0;                     // of the last bounce, if it was a diffuse one
+    for (int i = 0; i < m_maxBounces; i++)  // do m_maxBounces reflections
+    {
+        bool isLightSource = false;
+        sampler.startBounce(i);
+        if (i > 0) hit = pWorld->hit(r, 0.0001f, FLT_MAX, rec);
+        numRays++;
+        if (hit)
+        {
+            const Material &m = materials[rec.matId];
+            if (nee && m.kind == MaterialKind::Diffuse)
+            {
+                ray shadowRay;
+                float tMax;
+                vec3 light;
+                if (pLights->sample(rec, m.albedo, sampler, shadowRay, tMax, light) &&
+                    !pWorld->occluded(shadowRay, 0.0001f, tMax))
+                    radiance += runningAttenuation * light;
+            }
+            const vec3 from = r.origin();
+            if (scatter(m, r, rec, attenuation, isLightSource, sampler))
+                runningAttenuation *= attenuation;
+            else
+            {
+                if (!isLightSource) return radiance;
+                // a bounce ran into a light the shadow rays could have found
+                // too; it only gets its share
+                const float weight = (nee && bsdfPdf > 0 && m.kind == MaterialKind::Emmissive)?
+                    power_heuristic(bsdfPdf, pLights->pdf(from, rec)) : 1.0f;
+                return radiance + runningAttenuation * attenuation * weight;
+            }
+            bsdfPdf = (nee && m.kind == MaterialKind::Diffuse)? diffuse_pdf(r.direction(), rec.normal) : 0;
+            // past the first few bounces, dim paths take their chances. the
+            // cap on bounces stays, for paths that never get dim.
+            if (m_russianRoulette && i + 1 >= RUSSIAN_ROULETTE_DEPTH &&
+                !survives_roulette(runningAttenuation, sampler))
+                return radiance;
+        }
+        else return radiance + runningAttenuation * SKYBOX_COLOR;
+        // // lerp white...blue and multiply by attenuation
+        // vec3 unit_direction = unit_vector(r.direction());
+        // float t = 0.5f*(unit_direction.y()+1.0f);
+        // return runningAttenuation * ((1.0f-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0));
+    }
+
+    // exceeded recursion
+    return radiance;
+}
+
+// converts a finished pixel's color to RGBA8 and stores it
+inline void writePixel(uint32_t *pPixel, vec3 col)
+{
+    // to_display() (in the tree's vector.h) does the gamma and scales it to
+    // 0..255; the rest of this mess converts to uint8_t to chain together.
+    col = to_display(col);
+    uint8_t ir = uint8_t(col[0]);
+    uint8_t ig = uint8_t(col[1]);
+    uint8_t ib = uint8_t(col[2]);
+
+    // write directly to pixel buffer for efficiency
+    #if __BYTE_ORDER == __LITTLE_ENDIAN
+        *pPixel = (ir<<24) | (ig<<16) | (ib<<8) | 0xFF;
+    #elif __BYTE_ORDER == __BIG_ENDIAN
+        *pPixel = (0xFF<<24) | (ib<<16) | (ig<<8) | ir;
+    #else
+    # error "Please fix <bits/endian.h>"
+    #endif
+}
+
+// works out which pixels get samples this run: all of them, unless adaptive
+// sampling is on. then a pixel stops once it has had ADAPTIVE_MAX_SAMPLES,
+// or once it has had ADAPTIVE_MIN_SAMPLES and the noise left around it is
+// under ADAPTIVE_THRESHOLD (in 0..1 display units, so 1/255 is one step of
+// the final image).
+//
+// "around it" is the worst of the 3x3 pixels centred on it. a pixel's first
+// few samples can agree by luck -- say every bounce off the ground has
+// missed the lights so far -- and then it looks perfectly smooth when it
+// isn't; its neighbours have had samples of their own, and it's unlikely
+// they were all that lucky too. this is done before the threads start, so
+// nothing is reading the sums while they change.
+void ThreadPool::m_findActive()
+{
+    if (!m_adaptive)
+    {
+        std::fill(m_active.begin(), m_active.end(), 1);
+        return;
+    }
+    const PixelStats *pPixels = m_globalInfoPtr->pAccumBuffer;
+    parallel_for(m_height, [&](uint32_t y) {
+        for (int x = 0; x < m_width; x++)
+            m_noise[y*m_width + x] = pPixels[y*m_width + x].displayError();
+    });
+    parallel_for(m_height, [&](uint32_t y) {
+        const int yLo = (y > 0)? y - 1 : 0, yHi = (int(y) + 1 < m_height)? y + 1 : y;
+        for (int x = 0; x < m_width; x++)
+        {
+            const uint32_t numSamples = pPixels[y*m_width + x].numSamples;
+            float noise = 0;
+            const int xLo = (x > 0)? x - 1 : 0, xHi = (x + 1 < m_width)? x + 1 : x;
+            for (int ny = yLo; ny <= yHi; ny++)
+                for (int nx = xLo; nx <= xHi; nx++)
+                    noise = fmaxf(noise, m_noise[ny*m_width + nx]);
+            m_active[y*m_width + x] = numSamples < ADAPTIVE_MAX_SAMPLES &&
+                                           (numSamples < ADAPTIVE_MIN_SAMPLES || noise > ADAPTIVE_THRESHOLD);
+        }
+    });
+}
+
+void ThreadPool::doRayTrace(threadInfo *pGlobalInfo, uint32_t threadIndex, uint32_t tile)
+{
+    // find this tile's corner, and clip it to the image if it hangs off the
+    // right or bottom edge
+    const int x0 = (tile % m_numTilesX) * TILE_WIDTH;
+    const int y0 = (tile / m_numTilesX) * TILE_HEIGHT;
+    const int x1 = (x0 + TILE_WIDTH  < m_width)?  x0 + TILE_WIDTH  : m_width;
+    const int y1 = (y0 + TILE_HEIGHT < m_height)? y0 + TILE_HEIGHT : m_height;
+    //printf("tile %d (%d,%d)..(%d,%d) starting.\n", tile, x0, y0, x1, y1);
+
+    // which of the tile's pixels get samples this run, row by row
+    uint8_t active[TILE_WIDTH * TILE_HEIGHT];
+    uint32_t numActive = 0;
+    for (int y = y0; y < y1; y++)
+        for (int x = x0; x < x1; x++)
+        {
+            const bool a = m_active[y*m_width + x];
+            active[(y - y0)*TILE_WIDTH + (x - x0)] = a;
+            numActive += a;
+        }
+    if (numActive == 0) return;
+    m_samplesTraced.fetch_add(uint64_t(numActive) * m_numSamples, std::memory_order_relaxed);
+
+    if (m_integrator == Integrator::Wavefront)
+    {
+        const uint64_t numRays = m_wavefronts[threadIndex].render(pGlobalInfo->pWorld, pGlobalInfo->pMaterials, pGlobalInfo->pCam, m_width, m_height,
+                                         x0, y0, x1, y1, active, m_numSamples, m_sampler, pGlobalInfo->pAccumBuffer, m_russianRoulette, m_maxBounces,
+                                         m_nextEventEstimation? pGlobalInfo->pLights : nullptr);
+        m_raysTraced.fetch_add(numRays, std::memory_order_relaxed);
+        return;
+    }
+
+    uint64_t numRays = 0;
+#if USE_PACKETS == true
+    for (int py = y0; py < y1; py += PACKET_HEIGHT)
+        for (int px = x0; px < x1; px += PACKET_WIDTH)
+            numRays += m_tracePacket(pGlobalInfo, active, x0, y0, px, py, x1, y1);
+#else
+    Camera *pCam = pGlobalInfo->pCam;
+    Hitable *pWorld = pGlobalInfo->pWorld;
+    const MaterialTable &materials = *pGlobalInfo->pMaterials;
+    for (int y = y0; y < y1; y++)
+    {
+        PixelStats *pRow = pGlobalInfo->pAccumBuffer + y*m_width;
+        for (int x = x0; x < x1; x++)
+        {
+            if (!active[(y - y0)*TILE_WIDTH + (x - x0)]) continue;
+            // add this run's samples onto the pixel's sum; resolve()
+            // averages them. not only does this achieve basic antialiasing,
+            // but also smoothes out the render artifacts and raytracing noise.
+            PixelStats pixel = pRow[x];
+            uint32_t pixelRays = 0;
+            for (uint32_t s = 0; s < m_numSamples; s++)
+            {
+                // each sample gets its own sampler, seeded from where it is
+                // rather than which thread happens to be drawing it
+                Sampler sampler(m_sampler, x, y, pixel.numSamples);
+
+                // add a random offset for a slight randomization to the direction.
+                // this non-uniformity is what achieves the above benefits.
+                float du = 0, dv = 0;
+                sampler.next_2d(du, dv);
+                float u = float(x + du) * (1.0f / m_width);
+                float v = float(y + dv) * (1.0f / m_height);
+
+                ray r = pCam->getRay(u, v);
+
+                // clamping the colors to 0-1 is important because light sources
+                // can go above that, and cause overflow issues and really strange
+                // visual glitches.
+                pixel.add(color(r, pWorld, materials, pGlobalInfo->pLights, sampler, pixelRays).clamp(0.0f, 1.0f));
+            }
+            pRow[x] = pixel;
+            numRays += pixelRays;
+        }
+    }
+#endif
+    m_raysTraced.fetch_add(numRays, std::memory_order_relaxed);
+}
+
+// the pixels from (px,py) to (px+PACKET_WIDTH, py+PACKET_HEIGHT), clipped to
+// (x1,y1); pActive is the tile's mask, whose corner is (x0,y0). the camera
+// rays for each sample are traced as one packet, which is where neighbouring
+// rays still agree; everything after the first hit scatters every which way,
+// so the bounces go back to one ray at a time. each sample's rays and random
+// numbers are the same as without packets, so the image comes out the same
+// too. returns how many rays were traced.
+uint64_t ThreadPool::m_tracePacket(threadInfo *pGlobalInfo, const uint8_t *pActive, int x0, int y0, int px, int py, int x1, int y1)
+{
+    Camera *pCam = pGlobalInfo->pCam;
+    Hitable *pWorld = pGlobalInfo->pWorld;
+    const MaterialTable &materials = *pGlobalInfo->pMaterials;
+
+    PixelStats pixels[PACKET_SIZE];
+    bool inPacket[PACKET_SIZE];
+    bool any = false;
+    for (int i = 0; i < PACKET_SIZE; i++)
+    {
+        const int x = px + i % PACKET_WIDTH, y = py + i / PACKET_WIDTH;
+        inPacket[i] = x < x1 && y < y1 && pActive[(y - y0)*TILE_WIDTH + (x - x0)];
+        if (inPacket[i]) pixels[i] = pGlobalInfo->pAccumBuffer[y*m_width + x];
+        any |= inPacket[i];
+    }
+    if (!any) return 0;
+
+    uint32_t numRays = 0;
+    for (uint32_t s = 0; s < m_numSamples; s++)
+    {
+        Sampler samplers[PACKET_SIZE];
+        float u[PACKET_SIZE], v[PACKET_SIZE];
+        for (int i = 0; i < PACKET_SIZE; i++)
+        {
+            const int x = px + i % PACKET_WIDTH, y = py + i / PACKET_WIDTH;
+            u[i] = v[i] = 0;
+            if (!inPacket[i]) continue;
+            samplers[i] = Sampler(m_sampler, x, y, pixels[i].numSamples);
+            float du = 0, dv = 0;
+            samplers[i].next_2d(du, dv);
+            u[i] = float(x + du) * (1.0f / m_width);
+            v[i] = float(y + dv) * (1.0f / m_height);
+        }
+
+        RayPacket packet;
+        pCam->getRays(u, v, packet);
+        for (int i = 0; i < PACKET_SIZE; i++)
+            if (!inPacket[i]) packet.disable(i);
+
+        hit_record recs[PACKET_SIZE];
+        pWorld->hit_packet(packet, 0.0001f, recs);
+        for (int i = 0; i < PACKET_SIZE; i++)
+        {
+            if (!packet.active(i)) continue;
+            ray r = packet.get(i);
+            pixels[i].add(color(r, pWorld, materials, pGlobalInfo->pLights, samplers[i], packet.tMax[i] < FLT_MAX, recs[i], numRays).clamp(0.0f, 1.0f));
+        }
+    }
+
+    for (int i = 0; i < PACKET_SIZE; i++)
+    {
+        const int x = px + i % PACKET_WIDTH, y = py + i / PACKET_WIDTH;
+        if (inPacket[i]) pGlobalInfo->pAccumBuffer[y*m_width + x] = pixels[i];
+    }
+    return numRays;
+}
+
+// throws away everything added up so far, so the next run starts a new image
+void ThreadPool::clear()
+{
+    parallel_for(m_height, [&](uint32_t y) {
+        PixelStats *pRow = m_globalInfoPtr->pAccumBuffer + y*m_width;
+        for (int x = 0; x < m_width; x++)
+            pRow[x] = PixelStats{ vec3(0,0,0), 0, 0 };
+    });
+}
+
+// turns the added up samples into the displayable image: every pixel's sum
+// is divided by its number of samples and written to pTextureBuffer as
+// RGBA8. it only reads pAccumBuffer, so it can be done as often as wanted
+// between runs (but not during one, while the sums are still changing).
+void ThreadPool::resolve()
+{
+    parallel_for(m_height, [&](uint32_t y) {
+        const PixelStats *pPixels = m_globalInfoPtr->pAccumBuffer + y*m_width;
+        uint32_t *pRow = m_globalInfoPtr->pTextureBuffer + y*m_width;
+        for (int x = 0; x < m_width; x++)
+        {
+            vec3 col = pPixels[x].sum;
+            if (pPixels[x].numSamples > 0) col /= pPixels[x].numSamples;
+            writePixel(pRow + x, col);
+        }
+    });
+}
+
+// like resolve(), but for saving: the averages go into pRGB as they are, three
+// floats a pixel, with no gamma and no rounding to 8 bits
+void ThreadPool::resolveLinear(float *pRGB)
+{
+    parallel_for(m_height, [&](uint32_t y) {
+        const PixelStats *pPixels = m_globalInfoPtr->pAccumBuffer + y*m_width;
+        float *pRow = pRGB + size_t(y)*m_width*3;
+        for (int x = 0; x < m_width; x++)
+        {
+            vec3 col = pPixels[x].sum;
+            if (pPixels[x].numSamples > 0) col /= pPixels[x].numSamples;
+            pRow[3*x] = col[0]; pRow[3*x + 1] = col[1]; pRow[3*x + 2] = col[2];
+        }
+    });
+}
+
+// like resolve(), but shows how many samples each pixel got instead: dark
+// blue for none, through green, to red for ADAPTIVE_MAX_SAMPLES or more.
+void ThreadPool::resolveHeatmap()
+{
+    parallel_for(m_height, [&](uint32_t y) {
+        const PixelStats *pPixels = m_globalInfoPtr->pAccumBuffer + y*m_width;
+        uint32_t *pRow = m_globalInfoPtr->pTextureBuffer + y*m_width;
+        for (int x = 0; x < m_width; x++)
+        {
+            float t = float(pPixels[x].numSamples) / ADAPTIVE_MAX_SAMPLES;
+            if (t > 1) t = 1;
+            const vec3 col = (t < 0.5f)? (1 - 2*t)*vec3(0,0,0.5f) + (2*t)*vec3(0,1,0)
+                                       : (2 - 2*t)*vec3(0,1,0) + (2*t - 1)*vec3(1,0,0);
+            writePixel(pRow + x, col);
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef WORKDEQUEH
+#define WORKDEQUEH
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+// Lock-free work-stealing deque, after Chase & Lev ("Dynamic Circular
+// Work-Stealing Deque", 2005) with the memory orderings from Le et al.
+// ("Correct and Efficient Work-Stealing for Weak Memory Models", 2013).
+//
+// The owning thread push()es and pop()s at the bottom, like a stack. Any
+// other thread can steal() from the top. Owner operations only touch the
+// shared top index when the deque is down to its last item, so the common
+// case is uncontended.
+//
+// The buffer never grows: every job (tile) is known up front, so it is sized
+// once by reset() and must not be overfilled.
+
+enum class StealResult { Success, Empty, Abort };
+
+class WorkDeque
+{
+public:
+    WorkDeque() {}
+
+    void reset(uint32_t capacity);
+    void push(uint32_t job);
+    bool pop(uint32_t &job);
+    StealResult steal(uint32_t &job);
+    bool empty() const;
+
+private:
+    std::unique_ptr<std::atomic<uint32_t>[]> m_buffer;
+    uint32_t m_capacity = 0;
+
+    // top and bottom live on their own cache lines; thieves hammer top while
+    // the owner hammers bottom.
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+};
+
+// not thread-safe; only call this while no one is using the deque
+inline void WorkDeque::reset(uint32_t capacity)
+{
+    if (capacity > m_capacity)
+    {
+        m_buffer.reset(new std::atomic<uint32_t>[capacity]);
+        m_capacity = capacity;
+    }
+    m_top.store(0, std::memory_order_relaxed);
+    m_bottom.store(0, std::memory_order_relaxed);
+}
+
+// owner only
+inline void WorkDeque::push(uint32_t job)
+{
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    m_buffer[b % m_capacity].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+// owner only
+inline bool WorkDeque::pop(uint32_t &job)
+{
+    // claim the bottom item first, then check if a thief got there too
+    const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // already empty
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    job = m_buffer[b % m_capacity].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // last item; race the thieves for it
+        const bool won = m_top.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+// any thread. Abort means another thread won the race for the top item, so
+// the deque may still have work in it and is worth trying again.
+inline StealResult WorkDeque::steal(uint32_t &job)
+{
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) return StealResult::Empty;
+
+    job = m_buffer[t % m_capacity].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed))
+        return StealResult::Abort;
+    return StealResult::Success;
+}
+
+inline bool WorkDeque::empty() const
+{
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t t = m_top.load(std::memory_order_relaxed);
+    return t >= b;
+}
+
+#endif